@@ -1,5 +1,17 @@
 #include "mpc.h"
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define MPC_MMAP
+#endif
+
 /*
 ** State Type
 */
@@ -30,26 +42,17 @@ static mpc_state_t mpc_state_new(void) {
 ** In mpc the input type has three modes of
 ** operation: String, File and Pipe.
 **
-** String is easy. The whole contents are
-** loaded into a buffer and scanned through.
-** The cursor can jump around at will making
-** backtracking easy.
-**
-** The second is a File which is also somewhat
-** easy. The contents are never loaded into
-** memory but backtracking can still be achieved
-** by seeking in the file at different positions.
+** String is easy. The contents are scanned
+** through where they are and the cursor can
+** jump around at will making backtracking easy.
 **
-** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and
-** only support a single character lookahead at
-** any point, when the input is marked for a
-** potential backtracking we start buffering any
-** input.
-**
-** This means that if we are requested to seek
-** back we can simply start reading from the
-** buffer instead of the input.
+** File and Pipe are read into a window that
+** keeps everything back to the oldest mark, so
+** going back never has to seek the stream or
+** push anything back into it. Files are read a
+** block at a time, but pipes a character at a
+** time so nothing past what the parser looked
+** at is taken from the stream.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -67,13 +70,74 @@ enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+/* How much of a file is read into the window at once */
+
+enum {
+  MPC_INPUT_BLOCK = 65536
+};
+
+/*
+** Small allocations made while parsing come from
+** a slab owned by the input. Each size class hands
+** out blocks from its own part of the slab, reusing
+** freed blocks first. Once that runs out the class
+** gets a chunk as large as all it has so far, and
+** anything bigger than the largest class goes to
+** malloc.
+**
+** Each class starts with MPC_SLAB_SIZE bytes, which
+** can be set when compiling mpc. The classes share
+** one allocation, padded so they don't start at the
+** same offset in a page, as the CPU stalls reads
+** that look like they overlap a recent write.
+*/
+
+#ifndef MPC_SLAB_SIZE
+#define MPC_SLAB_SIZE 4096
+#endif
+
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_MEM_CLASSES = 5,
+  MPC_MEM_MIN     = 16,
+  MPC_MEM_MAX     = MPC_MEM_MIN << (MPC_MEM_CLASSES-1),
+  MPC_MEM_SLAB    = (MPC_SLAB_SIZE + MPC_MEM_MAX - 1) / MPC_MEM_MAX * MPC_MEM_MAX + 3 * MPC_MEM_MAX
 };
 
 typedef struct {
-  char mem[64];
-} mpc_mem_t;
+  char *mem;
+  size_t len;
+  int c;
+} mpc_mem_chunk_t;
+
+typedef struct {
+  void *free;
+  char *next;
+  char *end;
+  size_t total;
+} mpc_mem_class_t;
+
+/*
+** Results of memoized parsers, keyed by the
+** parser, where it started, and whether errors
+** were suppressed or backtracking disabled as
+** both change what the parser returns.
+*/
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  int mode;
+  int ok;
+  mpc_state_t state;
+  char last;
+  mpc_result_t result;
+  mpc_err_t *merged;
+} mpc_memo_t;
+
+enum {
+  MPC_INPUT_MEMO_MIN      = 256,
+  MPC_INPUT_MEMO_PER_CHAR = 16
+};
 
 typedef struct {
 
@@ -81,10 +145,16 @@ typedef struct {
   char *filename;
   mpc_state_t state;
 
-  char *string;
-  char *buffer;
+  const char *string;
+  long length;
   FILE *file;
 
+  char *block;
+  long block_start;
+  long block_len;
+  long block_slots;
+  FILE *held;
+
   int suppress;
   int backtrack;
   int marks_slots;
@@ -94,27 +164,40 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  char *slab;
+  int mem_num;
+  int mem_slots;
+  mpc_mem_chunk_t *mem;
+  mpc_mem_class_t mem_classes[MPC_MEM_CLASSES];
+
+  int memo_num;
+  int memo_slots;
+  mpc_memo_t *memo;
 
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+/*
+** Inputs are set up once and then opened on each
+** thing to parse, so a context can keep the same
+** one, with its slab and buffers, across parses.
+*/
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+static void mpc_input_init(mpc_input_t *i) {
 
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
+  i->filename = NULL;
   i->type = MPC_INPUT_STRING;
-
   i->state = mpc_state_new();
 
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
-  i->buffer = NULL;
+  i->string = NULL;
+  i->length = 0;
   i->file = NULL;
 
+  i->block = NULL;
+  i->block_start = 0;
+  i->block_len = 0;
+  i->block_slots = 0;
+  i->held = NULL;
+
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
@@ -123,135 +206,230 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->slab = NULL;
+  i->mem_num = 0;
+  i->mem_slots = 0;
+  i->mem = NULL;
+  memset(i->mem_classes, 0, sizeof(mpc_mem_class_t) * MPC_MEM_CLASSES);
+
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
 
-  return i;
 }
 
-static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
+static void mpc_input_open(mpc_input_t *i, const char *filename, int type) {
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  int j;
 
-  i->filename = malloc(strlen(filename) + 1);
+  i->filename = realloc(i->filename, strlen(filename) + 1);
   strcpy(i->filename, filename);
-  i->type = MPC_INPUT_STRING;
-
+  i->type = type;
   i->state = mpc_state_new();
 
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
-  i->buffer = NULL;
+  i->string = NULL;
+  i->length = 0;
   i->file = NULL;
 
+  i->block_start = 0;
+  i->block_len = 0;
+  i->held = NULL;
+
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  /* Anything left in the slab is dropped, and it goes back to only the first chunk of each class */
+  for (j = 0; j < i->mem_num; j++) { free(i->mem[j].mem); }
+  i->mem_num = 0;
+  memset(i->mem_classes, 0, sizeof(mpc_mem_class_t) * MPC_MEM_CLASSES);
 
-  return i;
+  i->memo_num = 0;
 
 }
 
-static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
-
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
-
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
+/*
+** String input reads straight from the caller's
+** buffer, which only has to outlive the parse.
+** It stops at the given length or the first zero
+** byte, whichever comes first.
+*/
 
-  i->type = MPC_INPUT_PIPE;
-  i->state = mpc_state_new();
+static void mpc_input_open_nstring(mpc_input_t *i, const char *filename, const char *string, size_t length) {
+  mpc_input_open(i, filename, MPC_INPUT_STRING);
+  i->string = string;
+  i->length = (long)length;
+}
 
-  i->string = NULL;
-  i->buffer = NULL;
+static void mpc_input_open_pipe(mpc_input_t *i, const char *filename, FILE *pipe) {
+  long held = i->held == pipe ? i->block_len : 0;
+  mpc_input_open(i, filename, MPC_INPUT_PIPE);
   i->file = pipe;
 
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  /* What the last parse of this pipe read past its end is read first */
+  i->block_len = held;
+}
 
-  return i;
+static void mpc_input_open_file(mpc_input_t *i, const char *filename, FILE *file) {
+  mpc_input_open(i, filename, MPC_INPUT_FILE);
+  i->file = file;
 
+  /* Positions are offsets into the file so rewinds land right when parsing starts part way in */
+  i->state.pos = ftell(file);
+  i->block_start = i->state.pos;
 }
 
-static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
+/*
+** A pipe can't be put back where the parse ended
+** as `ungetc` is only sure to take one character.
+** Instead what was read past the end stays at the
+** front of the window, and is read first if the
+** same pipe is parsed next.
+*/
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+static void mpc_input_close(mpc_input_t *i) {
 
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
-  i->type = MPC_INPUT_FILE;
-  i->state = mpc_state_new();
+  long n;
 
+  /* Leave the file just after what was parsed, as if it had been read a character at a time */
+  if (i->type == MPC_INPUT_FILE) { fseek(i->file, i->state.pos, SEEK_SET); }
+
+  if (i->type == MPC_INPUT_PIPE) {
+    n = i->block_start + i->block_len - i->state.pos;
+    if (n > 0) { memmove(i->block, i->block + (i->state.pos - i->block_start), n); }
+    i->block_start = 0;
+    i->block_len = n;
+    i->held = n > 0 ? i->file : NULL;
+  }
+
+  i->file = NULL;
   i->string = NULL;
-  i->buffer = NULL;
-  i->file = file;
+}
 
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
+static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  mpc_input_init(i);
+  mpc_input_open_nstring(i, filename, string, length);
+  return i;
+}
+
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+  return mpc_input_new_nstring(filename, string, strlen(string));
+}
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  mpc_input_init(i);
+  mpc_input_open_pipe(i, filename, pipe);
+  return i;
+}
 
+static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  mpc_input_init(i);
+  mpc_input_open_file(i, filename, file);
   return i;
 }
 
-static void mpc_input_delete(mpc_input_t *i) {
+static void mpc_input_free(mpc_input_t *i) {
+
+  int j;
 
   free(i->filename);
+  free(i->block);
 
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  free(i->slab);
+  for (j = 0; j < i->mem_num; j++) { free(i->mem[j].mem); }
+  free(i->mem);
 
   free(i->marks);
   free(i->lasts);
+}
+
+/* Without a context to keep it in, a single character read past the end can still go back to the pipe */
+static void mpc_input_delete(mpc_input_t *i) {
+  mpc_input_close(i);
+  if (i->held && i->block_len == 1) { ungetc(i->block[0], i->held); }
+  mpc_input_free(i);
   free(i);
 }
 
-static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+/* Size class of the block at `p`, or -1 if it came from malloc */
+static int mpc_mem_class(mpc_input_t *i, void *p) {
+  int lo = 0, hi = i->mem_num - 1, mid;
+
+  if (i->slab && (char*)p >= i->slab && (char*)p < i->slab + MPC_MEM_CLASSES * MPC_MEM_SLAB) {
+    return (int)(((char*)p - i->slab) / MPC_MEM_SLAB);
+  }
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if ((char*)p < i->mem[mid].mem) { hi = mid - 1; continue; }
+    if ((char*)p >= i->mem[mid].mem + i->mem[mid].len) { lo = mid + 1; continue; }
+    return i->mem[mid].c;
+  }
+
+  return -1;
+}
+
+static void mpc_mem_grow(mpc_input_t *i, int c) {
+
+  int j;
+  mpc_mem_class_t *k = &i->mem_classes[c];
+  mpc_mem_chunk_t x;
+
+  if (k->total == 0) {
+    if (!i->slab) { i->slab = malloc(MPC_MEM_CLASSES * MPC_MEM_SLAB); }
+    k->next = i->slab + c * MPC_MEM_SLAB;
+    k->end = k->next + MPC_MEM_SLAB;
+    k->total = MPC_MEM_SLAB;
+    return;
+  }
+
+  x.mem = malloc(k->total);
+  x.len = k->total;
+  x.c = c;
+
+  /* Chunks are kept in address order for mpc_mem_class */
+  if (i->mem_num == i->mem_slots) {
+    i->mem_slots = i->mem_slots ? i->mem_slots * 2 : MPC_MEM_CLASSES;
+    i->mem = realloc(i->mem, sizeof(mpc_mem_chunk_t) * i->mem_slots);
+  }
+
+  for (j = i->mem_num; j > 0 && i->mem[j-1].mem > x.mem; j--) {
+    i->mem[j] = i->mem[j-1];
+  }
+  i->mem[j] = x;
+  i->mem_num++;
+
+  k->next = x.mem;
+  k->end = x.mem + x.len;
+  k->total += x.len;
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
+
+  int c = 0;
   char *p;
+  mpc_mem_class_t *k;
 
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  if (n > MPC_MEM_MAX) { return malloc(n); }
 
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  while ((size_t)(MPC_MEM_MIN << c) < n) { c++; }
+  k = &i->mem_classes[c];
 
-  return malloc(n);
+  if (k->free) {
+    p = k->free;
+    k->free = *(void**)p;
+    return p;
+  }
+
+  if (k->next == k->end) { mpc_mem_grow(i, c); }
+
+  p = k->next;
+  k->next += MPC_MEM_MIN << c;
+  return p;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -260,23 +438,31 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
   return x;
 }
 
+static void mpc_mem_release(mpc_input_t *i, int c, void *p) {
+  *(void**)p = i->mem_classes[c].free;
+  i->mem_classes[c].free = p;
+}
+
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
-  if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  int c = mpc_mem_class(i, p);
+  if (c == -1) { free(p); return; }
+  mpc_mem_release(i, c, p);
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
   char *q = NULL;
+  int c;
+
+  if (p == NULL) { return mpc_malloc(i, n); }
 
-  if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  c = mpc_mem_class(i, p);
+  if (c == -1) { return realloc(p, n); }
 
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
-    mpc_free(i, p);
+  if (n > (size_t)(MPC_MEM_MIN << c)) {
+    q = mpc_malloc(i, n);
+    memcpy(q, p, MPC_MEM_MIN << c);
+    mpc_mem_release(i, c, p);
     return q;
   }
 
@@ -285,10 +471,11 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
-  if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
-  mpc_free(i, p);
+  int c = mpc_mem_class(i, p);
+  if (c == -1) { return p; }
+  q = malloc(MPC_MEM_MIN << c);
+  memcpy(q, p, MPC_MEM_MIN << c);
+  mpc_mem_release(i, c, p);
   return q;
 }
 
@@ -313,14 +500,9 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
-  int j;
 
   if (i->backtrack < 1) { return; }
 
@@ -335,14 +517,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    for (j = strlen(i->buffer) - 1; j >= 0; j--)
-      ungetc(i->buffer[j], i->file);
-
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
@@ -352,19 +526,49 @@ static void mpc_input_rewind(mpc_input_t *i) {
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
 
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
-  }
-
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+static int mpc_input_fill(mpc_input_t *i) {
+
+  int c;
+  long keep, end = i->block_start + i->block_len;
+  size_t n;
+
+  /* Drop what is before both the oldest mark and the current position */
+  keep = i->marks_num > 0 ? i->marks[0].pos : i->state.pos;
+  if (keep > i->state.pos) { keep = i->state.pos; }
+  if (keep > end) { keep = end; }
+
+  /* Only once it is half the window, so each character is moved a bounded number of times */
+  if (keep > i->block_start && keep - i->block_start >= i->block_len / 2) {
+    memmove(i->block, i->block + (keep - i->block_start), end - keep);
+    i->block_len = end - keep;
+    i->block_start = keep;
+  }
+
+  while (i->block_slots - i->block_len < (i->type == MPC_INPUT_PIPE ? 1 : MPC_INPUT_BLOCK / 2)) {
+    i->block_slots = i->block_slots ? i->block_slots * 2 : MPC_INPUT_BLOCK;
+    i->block = realloc(i->block, i->block_slots);
+  }
+
+  if (i->type == MPC_INPUT_PIPE) {
+    c = getc(i->file);
+    if (c == EOF) { return 0; }
+    i->block[i->block_len++] = (char)c;
+    return 1;
+  }
+
+  n = fread(i->block + i->block_len, 1, i->block_slots - i->block_len, i->file);
+  i->block_len += (long)n;
+  return n > 0;
 }
 
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+static char mpc_input_block_get(mpc_input_t *i) {
+  while (i->state.pos >= i->block_start + i->block_len) {
+    if (!mpc_input_fill(i)) { return '\0'; }
+  }
+  return i->block[i->state.pos - i->block_start];
 }
 
 static char mpc_input_getc(mpc_input_t *i) {
@@ -373,19 +577,9 @@ static char mpc_input_getc(mpc_input_t *i) {
 
   switch (i->type) {
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) { c = getc(i->file); return c; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
+    case MPC_INPUT_FILE:
+    case MPC_INPUT_PIPE: return mpc_input_block_get(i);
 
     default: return c;
   }
@@ -396,32 +590,9 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
 
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE:
-
-      c = fgetc(i->file);
-      if (feof(i->file)) { return '\0'; }
-
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
-
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+    case MPC_INPUT_PIPE: return mpc_input_block_get(i);
 
     default: return c;
   }
@@ -432,35 +603,14 @@ static int mpc_input_terminated(mpc_input_t *i) {
   return mpc_input_peekc(i) == '\0';
 }
 
+/* Every input keeps what it has read, so a failed match has nothing to give back */
 static int mpc_input_failure(mpc_input_t *i, char c) {
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
-    case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) { ungetc(c, i->file); break; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
-    default: { break; }
-  }
+  (void)i; (void)c;
   return 0;
 }
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
 
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -479,6 +629,8 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   return 1;
 }
 
+#define MPC_CLASS_HAS(m, c) ((m)[(unsigned char)(c) / 8] & (1 << ((unsigned char)(c) % 8)))
+
 static int mpc_input_any(mpc_input_t *i, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
@@ -500,18 +652,67 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
-  char x;
-  if (mpc_input_terminated(i)) { return 0; }
-  x = mpc_input_getc(i);
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+/*
+** Length of the run of the first `l` bytes of
+** `s` in the class. With SSSE3 a block is looked
+** up sixteen bytes at a time, splitting each
+** byte into nibbles: the low one picks a column
+** of bits, one per value of the high nibble,
+** which then picks the bit.
+*/
+
+static size_t mpc_class_span(const unsigned char *m, const char *s, size_t l) {
+
+  size_t n = 0;
+#if defined(__SSSE3__)
+  int b, mask;
+  unsigned char lo[16], hi[16];
+  __m128i v, row, col, upper, in_lo, in_hi, bits, nibble, seven;
+#endif
+
+  /* Short runs are the common case so try those first */
+  while (n < 16 && n < l && MPC_CLASS_HAS(m, s[n])) { n++; }
+  if (n < 16) { return n; }
+
+#if defined(__SSSE3__)
+  memset(lo, 0, 16);
+  memset(hi, 0, 16);
+  for (b = 0; b < 256; b++) {
+    if (!MPC_CLASS_HAS(m, b)) { continue; }
+    if (b < 128) { lo[b & 15] |= 1 << (b >> 4); }
+    else         { hi[b & 15] |= 1 << ((b >> 4) - 8); }
+  }
+
+  in_lo  = _mm_loadu_si128((const __m128i*)lo);
+  in_hi  = _mm_loadu_si128((const __m128i*)hi);
+  bits   = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+  nibble = _mm_set1_epi8(0x0F);
+  seven  = _mm_set1_epi8(7);
+
+  while (n + 16 <= l) {
+    v = _mm_loadu_si128((const __m128i*)(s + n));
+    col = _mm_and_si128(v, nibble);
+    row = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+    upper = _mm_cmpgt_epi8(row, seven);
+    v = _mm_or_si128(
+      _mm_and_si128(upper, _mm_shuffle_epi8(in_hi, col)),
+      _mm_andnot_si128(upper, _mm_shuffle_epi8(in_lo, col)));
+    v = _mm_and_si128(v, _mm_shuffle_epi8(bits, row));
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    if (mask) { return n + __builtin_ctz(mask); }
+    n += 16;
+  }
+#endif
+
+  while (n < l && MPC_CLASS_HAS(m, s[n])) { n++; }
+  return n;
 }
 
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_class(mpc_input_t *i, const unsigned char *m, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return MPC_CLASS_HAS(m, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -728,7 +929,7 @@ static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
   return mpc_export(i, x);
 }
 
-static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
+static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, const char *expected) {
   int j;
   (void)i;
   for (j = 0; j < x->expected_num; j++) {
@@ -737,7 +938,7 @@ static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expecte
   return 0;
 }
 
-static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
+static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, const char *expected) {
   (void)i;
   x->expected_num++;
   x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
@@ -916,7 +1117,10 @@ enum {
   MPC_TYPE_CHECK_WITH = 26,
 
   MPC_TYPE_SOI        = 27,
-  MPC_TYPE_EOI        = 28
+  MPC_TYPE_EOI        = 28,
+
+  MPC_TYPE_DFA        = 29,
+  MPC_TYPE_MEMO       = 30
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -926,7 +1130,7 @@ typedef struct { int(*f)(char,char); } mpc_pdata_anchor_t;
 typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
-typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; unsigned char m[32]; } mpc_pdata_string_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_t f; char *e; } mpc_pdata_check_t;
@@ -934,8 +1138,12 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_with_t f; void *d; ch
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct mpc_dispatch_t mpc_dispatch_t;
+typedef struct { int n; mpc_parser_t **xs; mpc_dispatch_t *d; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct mpc_dfa_t mpc_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_dfa_t *d; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_apply_t cp; } mpc_pdata_memo_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -955,6 +1163,8 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_memo_t memo;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -1034,283 +1244,1048 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
-enum {
-  MPC_PARSE_STACK_MIN = 4
-};
-
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+/*
+** A `many` over a character class with string
+** input takes the whole run at once instead of
+** parsing and folding each character. It fails
+** the same way the last character would have.
+*/
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+static int mpc_input_many_class(mpc_input_t *i, mpc_parser_t *p, char **o, mpc_err_t **e) {
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+  size_t j, n;
+  const char *m = NULL, *s;
+  mpc_parser_t *x = p->data.repeat.x;
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  if (i->type != MPC_INPUT_STRING || p->data.repeat.f != mpcf_strfold) { return 0; }
 
-  if (depth == MPC_MAX_RECURSION_DEPTH)
-  {
-    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  while (x->type == MPC_TYPE_EXPECT) {
+    if (m == NULL) { m = x->data.expect.m; }
+    x = x->data.expect.x;
   }
 
-  switch (p->type) {
+  if (x->type != MPC_TYPE_ONEOF && x->type != MPC_TYPE_NONEOF) { return 0; }
 
-    /* Basic Parsers */
-
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
-    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
-
-    /* Other parsers */
-
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
-
-    /* Application Parsers */
-
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
+  s = i->string + i->state.pos;
+  n = mpc_class_span(x->data.string.m, s, i->length - i->state.pos);
+  if (n == 0 && p->type == MPC_TYPE_MANY1) { return 0; }
 
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  for (j = 0; j < n; j++) {
+    if (s[j] == '\n') { i->state.col = 0; i->state.row++; }
+    else { i->state.col++; }
+  }
+  if (n > 0) { i->last = s[n-1]; }
+  i->state.pos += n;
 
-    case MPC_TYPE_CHECK:
-      if (mpc_parse_run(i, p->data.check.x, r, e, depth+1)) {
-        if (p->data.check.f(&r->output)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  *o = mpc_malloc(i, n + 1);
+  memcpy(*o, s, n);
+  (*o)[n] = '\0';
 
-    case MPC_TYPE_CHECK_WITH:
-      if (mpc_parse_run(i, p->data.check_with.x, r, e, depth+1)) {
-        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  *e = mpc_err_merge(i, *e, m ? mpc_err_new(i, m) : NULL);
+  return 1;
+}
 
-    case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e, depth+1)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
-      }
+/*
+** Regex DFA
+**
+** Regular expressions which are simple enough
+** are also compiled to a position automaton so
+** they can be matched a byte at a time without
+** going through the combinators. Its states are
+** sets of positions and are only built as the
+** input reaches them, each with a full byte
+** transition table.
+**
+** A match still reports what the combinators
+** would have expected where it stopped. Each
+** position keeps the positions tried after it,
+** in the order the combinators try them, and the
+** outermost `expect` it falls under.
+*/
 
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e, depth+1)) {
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
+enum {
+  MPC_DFA_DEAD       = -1,
+  MPC_DFA_UNBUILT    = -2,
+  MPC_DFA_POS_MAX    = 1024,
+  MPC_DFA_STATES_MAX = 1024
+};
 
-    /* Optional Parsers */
+struct mpc_dfa_t {
+  int npos;
+  int words;
+  unsigned char *chars;
+  unsigned int *follow;
+  unsigned int *final;
+  int states_num;
+  int states_slots;
+  unsigned int *sets;
+  char *accept;
+  int *next;
+  const char **expects;
+  int *tails_at;
+  int *tails;
+  int tails_num;
+  int tails_slots;
+};
 
-    /* TODO: Update Not Error Message */
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *x);
 
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+#define MPC_DFA_BIT(s, j) ((s)[(j) / 32] & (1u << ((j) % 32)))
+#define MPC_DFA_SET(s, j) ((s)[(j) / 32] |= (1u << ((j) % 32)))
 
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+static int mpc_dfa_state(mpc_dfa_t *d, unsigned int *set) {
 
-    /* Repeat Parsers */
+  int j, k;
 
-    case MPC_TYPE_MANY:
+  for (j = 0; j < d->states_num; j++) {
+    if (memcmp(d->sets + j * d->words, set, d->words * sizeof(unsigned int)) == 0) { return j; }
+  }
 
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
+  if (d->states_num == MPC_DFA_STATES_MAX) { return MPC_DFA_UNBUILT; }
 
-      *e = mpc_err_merge(i, *e, results[j].error);
+  if (d->states_num == d->states_slots) {
+    d->states_slots = d->states_slots ? d->states_slots * 2 : 8;
+    d->sets = realloc(d->sets, sizeof(unsigned int) * d->words * d->states_slots);
+    d->accept = realloc(d->accept, d->states_slots);
+    d->next = realloc(d->next, sizeof(int) * 256 * d->states_slots);
+  }
 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+  j = d->states_num++;
+  memcpy(d->sets + j * d->words, set, d->words * sizeof(unsigned int));
+  d->accept[j] = 0;
+  for (k = 0; k < d->words; k++) { if (set[k] & d->final[k]) { d->accept[j] = 1; } }
+  for (k = 0; k < 256; k++) { d->next[j * 256 + k] = MPC_DFA_UNBUILT; }
 
-    case MPC_TYPE_MANY1:
+  return j;
+}
 
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
+static int mpc_dfa_next(mpc_dfa_t *d, int s, unsigned char c) {
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
+  int q, r, k, t, empty = 1;
+  unsigned int *from, *set;
 
-        *e = mpc_err_merge(i, *e, results[j].error);
+  t = d->next[s * 256 + c];
+  if (t != MPC_DFA_UNBUILT) { return t; }
 
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+  set = calloc(d->words, sizeof(unsigned int));
+  from = d->sets + s * d->words;
 
-    case MPC_TYPE_COUNT:
+  for (q = 0; q < d->npos; q++) {
+    if (!MPC_DFA_BIT(from, q)) { continue; }
+    for (k = 0; k < d->words; k++) { set[k] |= d->follow[q * d->words + k]; }
+  }
+
+  for (r = 0; r < d->npos; r++) {
+    if (!MPC_DFA_BIT(set, r)) { continue; }
+    if (d->chars[r * 32 + c / 8] & (1 << (c % 8))) { empty = 0; }
+    else { set[r / 32] &= ~(1u << (r % 32)); }
+  }
+
+  t = empty ? MPC_DFA_DEAD : mpc_dfa_state(d, set);
+  free(set);
+
+  if (t != MPC_DFA_UNBUILT) { d->next[s * 256 + c] = t; }
+  return t;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  free(d->expects);
+  free(d->tails_at);
+  free(d->tails);
+  free(d->chars);
+  free(d->follow);
+  free(d->final);
+  free(d->sets);
+  free(d->accept);
+  free(d->next);
+  free(d);
+}
+
+/*
+** Consumes the longest match, returning -1 when
+** the automaton can't decide this input and the
+** combinators have to be used instead.
+*/
+
+static int mpc_input_dfa(mpc_input_t *i, mpc_dfa_t *d, char **o, mpc_err_t **e) {
+
+  char c;
+  char stk[64];
+  char *buf = stk;
+  int s = 0, t = 0, n = 0, q, j, slots = 64, accepted = -1;
+  const char *m;
+  mpc_err_t *x = NULL;
+
+  if (i->backtrack < 1) { return -1; }
+
+  mpc_input_mark(i);
+
+  if (d->accept[0]) { accepted = 0; }
+
+  while (!mpc_input_terminated(i)) {
+    c = mpc_input_getc(i);
+    t = mpc_dfa_next(d, s, (unsigned char)c);
+    if (t < 0) { mpc_input_failure(i, c); break; }
+    mpc_input_success(i, c, NULL);
+    if (n == slots) {
+      slots *= 2;
+      if (buf == stk) { buf = malloc(slots); memcpy(buf, stk, n); }
+      else { buf = realloc(buf, slots); }
+    }
+    buf[n++] = c;
+    s = t;
+    if (d->accept[s]) { accepted = n; }
+  }
 
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+  if (t == MPC_DFA_UNBUILT || accepted < 0) {
+    mpc_input_rewind(i);
+    if (buf != stk) { free(buf); }
+    return t == MPC_DFA_UNBUILT ? -1 : 0;
+  }
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
+  /* What would have been tried next fails where the automaton stopped */
+  if (!i->suppress) {
+    for (q = 0; q < d->npos; q++) {
+      if (!MPC_DFA_BIT(d->sets + s * d->words, q)) { continue; }
+      for (j = d->tails_at[q]; j < d->tails_at[q+1]; j++) {
+        m = d->expects[d->tails[j]];
+        if (m == NULL) { continue; }
+        if (x == NULL) { x = mpc_err_new(i, m); }
+        else if (!mpc_err_contains_expected(i, x, m)) { mpc_err_add_expected(i, x, m); }
       }
+    }
+    if (x) { *e = mpc_err_merge(i, *e, x); }
+  }
 
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+  /* Went past the last accepting state so give that back */
+  if (accepted < n) {
+    mpc_input_rewind(i);
+    for (n = 0; n < accepted; n++) {
+      mpc_input_success(i, mpc_input_getc(i), NULL);
+    }
+  } else {
+    mpc_input_unmark(i);
+  }
+
+  *o = mpc_malloc(i, accepted + 1);
+  memcpy(*o, buf, accepted);
+  (*o)[accepted] = '\0';
+
+  if (buf != stk) { free(buf); }
+  return 1;
+}
+
+/*
+** Memo Table
+**
+** Open addressing over the input. It is flushed
+** rather than grown once it holds more entries
+** than a fixed number per character read, so it
+** stays bounded by the size of the input.
+*/
+
+static mpc_err_t *mpc_err_copy(mpc_input_t *i, mpc_err_t *x) {
+  int j;
+  mpc_err_t *y;
+  if (x == NULL) { return NULL; }
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  *y = *x;
+  y->filename = mpc_malloc(i, strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = mpc_malloc(i, strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  if (x->failure) {
+    y->failure = mpc_malloc(i, strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  return y;
+}
+
+static int mpc_memo_mode(mpc_input_t *i) {
+  return (i->suppress > 0) | ((i->backtrack > 0) << 1);
+}
+
+static size_t mpc_memo_hash(mpc_parser_t *p, long pos, int mode) {
+  return ((size_t)p >> 4) * 31 + (size_t)pos * 2654435761u + (size_t)mode;
+}
+
+static mpc_memo_t *mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, long pos, int mode) {
+  size_t h;
+  mpc_memo_t *m;
+  if (i->memo_slots == 0) { return NULL; }
+  h = mpc_memo_hash(p, pos, mode) & (i->memo_slots - 1);
+  while (1) {
+    m = &i->memo[h];
+    if (m->p == NULL) { return m; }
+    if (m->p == p && m->pos == pos && m->mode == mode) { return m; }
+    h = (h + 1) & (i->memo_slots - 1);
+  }
+}
+
+static void mpc_memo_clear(mpc_input_t *i) {
+  int j;
+  mpc_memo_t *m;
+  for (j = 0; j < i->memo_slots; j++) {
+    m = &i->memo[j];
+    if (m->p == NULL) { continue; }
+    if (m->ok) { mpc_parse_dtor(i, m->p->data.memo.dx, m->result.output); }
+    else { mpc_err_delete_internal(i, m->result.error); }
+    mpc_err_delete_internal(i, m->merged);
+    m->p = NULL;
+  }
+  i->memo_num = 0;
+}
+
+static mpc_memo_t *mpc_memo_add(mpc_input_t *i, mpc_parser_t *p, long pos, int mode) {
+
+  int j, slots;
+  mpc_memo_t *m, *memo;
+
+  if (i->memo_num + 1 > i->memo_slots / 2) {
+
+    if (i->memo_num >= MPC_INPUT_MEMO_MIN
+    &&  i->memo_num >= (i->state.pos + 1) * MPC_INPUT_MEMO_PER_CHAR) {
+      mpc_memo_clear(i);
+    } else {
+      memo = i->memo;
+      slots = i->memo_slots;
+      i->memo_slots = slots ? slots * 2 : MPC_INPUT_MEMO_MIN;
+      i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+      for (j = 0; j < slots; j++) {
+        if (memo[j].p == NULL) { continue; }
+        *mpc_memo_find(i, memo[j].p, memo[j].pos, memo[j].mode) = memo[j];
       }
+      free(memo);
+    }
+
+  }
+
+  m = mpc_memo_find(i, p, pos, mode);
+  m->p = p;
+  m->pos = pos;
+  m->mode = mode;
+  i->memo_num++;
+  return m;
+}
+
+static void mpc_memo_delete(mpc_input_t *i) {
+  mpc_memo_clear(i);
+  free(i->memo);
+  i->memo = NULL;
+  i->memo_slots = 0;
+}
+
+/*
+** Dispatch Tables
+**
+** An optimised `or` works out what each of its
+** alternatives can start with the first time it
+** is run, by which point the rules it refers to
+** should all be defined. Alternatives that can't
+** start with the next character or match nothing
+** are then skipped. They could only have failed
+** where they started, always expecting the same
+** things, so that is worked out once up front and
+** added to the error in place of running them.
+*/
+
+typedef struct {
+  int num;
+  char **xs;
+} mpc_dispatch_expect_t;
+
+struct mpc_dispatch_t {
+  int n;
+  unsigned char *first;
+  mpc_dispatch_expect_t *fails;
+  int start[256];
+};
+
+typedef struct mpc_dispatch_path_t {
+  mpc_parser_t *p;
+  struct mpc_dispatch_path_t *prev;
+} mpc_dispatch_path_t;
+
+static int mpc_dfa_chars(mpc_parser_t *p, unsigned char *set);
+
+static int mpc_dispatch_any(unsigned char *set) {
+  memset(set, 0xFF, 32);
+  set[0] &= ~1;
+  return 1;
+}
+
+/* Returns if `p` might match nothing, adding what it might start with to `set` */
+static int mpc_dispatch_first(mpc_parser_t *p, unsigned char *set, mpc_dispatch_path_t *path) {
 
-    /* Combinatory Parsers */
+  int j, nullable = 0;
+  unsigned char c;
+  mpc_dispatch_path_t here;
+
+  /* Going round a loop of rules without reading anything */
+  for (here.prev = path; path; path = path->prev) {
+    if (path->p == p) { return mpc_dispatch_any(set); }
+  }
+
+  here.p = p;
+  path = p->retained ? &here : here.prev;
+
+  switch (p->type) {
+
+    case MPC_TYPE_PASS: case MPC_TYPE_LIFT: case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE: case MPC_TYPE_ANCHOR: case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI: case MPC_TYPE_NOT: return 1;
+
+    case MPC_TYPE_FAIL: return 0;
+
+    case MPC_TYPE_STRING:
+      c = (unsigned char)p->data.string.x[0];
+      if (c == '\0') { return 1; }
+      set[c / 8] |= 1 << (c % 8);
+      return 0;
+
+    case MPC_TYPE_EXPECT:     return mpc_dispatch_first(p->data.expect.x, set, path);
+    case MPC_TYPE_APPLY:      return mpc_dispatch_first(p->data.apply.x, set, path);
+    case MPC_TYPE_APPLY_TO:   return mpc_dispatch_first(p->data.apply_to.x, set, path);
+    case MPC_TYPE_CHECK:      return mpc_dispatch_first(p->data.check.x, set, path);
+    case MPC_TYPE_CHECK_WITH: return mpc_dispatch_first(p->data.check_with.x, set, path);
+    case MPC_TYPE_PREDICT:    return mpc_dispatch_first(p->data.predict.x, set, path);
+    case MPC_TYPE_DFA:        return mpc_dispatch_first(p->data.dfa.x, set, path);
+    case MPC_TYPE_MEMO:       return mpc_dispatch_first(p->data.memo.x, set, path);
+
+    case MPC_TYPE_MAYBE: mpc_dispatch_first(p->data.not.x, set, path); return 1;
+    case MPC_TYPE_MANY: mpc_dispatch_first(p->data.repeat.x, set, path); return 1;
+    case MPC_TYPE_MANY1: return mpc_dispatch_first(p->data.repeat.x, set, path);
+
+    case MPC_TYPE_COUNT:
+      nullable = mpc_dispatch_first(p->data.repeat.x, set, path);
+      return nullable || p->data.repeat.n == 0;
 
     case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        nullable |= mpc_dispatch_first(p->data.or.xs[j], set, path);
+      }
+      return nullable || p->data.or.n == 0;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dispatch_first(p->data.and.xs[j], set, path)) { return 0; }
+      }
+      return 1;
+
+    default: return mpc_dfa_chars(p, set) ? 0 : mpc_dispatch_any(set);
+  }
+
+}
+
+static void mpc_dispatch_expect_add(mpc_dispatch_expect_t *x, const char *s) {
+  int j;
+  for (j = 0; j < x->num; j++) {
+    if (strcmp(x->xs[j], s) == 0) { return; }
+  }
+  x->xs = realloc(x->xs, sizeof(char*) * (x->num + 1));
+  x->xs[x->num] = malloc(strlen(s) + 1);
+  strcpy(x->xs[x->num], s);
+  x->num++;
+}
+
+static void mpc_dispatch_expect_clear(mpc_dispatch_expect_t *x) {
+  int j;
+  for (j = 0; j < x->num; j++) { free(x->xs[j]); }
+  free(x->xs);
+  x->num = 0;
+  x->xs = NULL;
+}
+
+static void mpc_dispatch_expect_cat(mpc_dispatch_expect_t *x, mpc_dispatch_expect_t *y) {
+  int j;
+  for (j = 0; j < y->num; j++) { mpc_dispatch_expect_add(x, y->xs[j]); }
+  mpc_dispatch_expect_clear(y);
+}
+
+/* Joins the expected into one as `mpc_err_repeat` does */
+static void mpc_dispatch_expect_repeat(mpc_dispatch_expect_t *x, const char *prefix) {
 
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+  int j;
+  size_t l;
+  char *s;
+
+  if (x->num == 0) { return; }
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+  l = strlen(prefix) + 1;
+  for (j = 0; j < x->num; j++) { l += strlen(x->xs[j]) + strlen(" or "); }
 
+  s = malloc(l);
+  strcpy(s, prefix);
+  for (j = 0; j < x->num; j++) {
+    if (j > 0) { strcat(s, j == x->num-1 ? " or " : ", "); }
+    strcat(s, x->xs[j]);
+  }
+
+  mpc_dispatch_expect_clear(x);
+  x->num = 1;
+  x->xs = malloc(sizeof(char*));
+  x->xs[0] = s;
+}
+
+/*
+** Plays out `p` when the next character is one it
+** can't start with, gathering what it adds to the
+** running error in `side` and what it fails with
+** in `ret`. Gives 1 if it matches nothing, 0 if it
+** fails, or -1 if that depends on more than just
+** the next character.
+*/
+
+static int mpc_dispatch_fail(mpc_parser_t *p, mpc_dispatch_expect_t *side,
+  mpc_dispatch_expect_t *ret, mpc_dispatch_path_t *path) {
+
+  int j, k;
+  char prefix[32];
+  mpc_dispatch_expect_t s, t;
+  mpc_dispatch_path_t here;
+
+  for (here.prev = path; path; path = path->prev) {
+    if (path->p == p) { return -1; }
+  }
+
+  here.p = p;
+  path = p->retained ? &here : here.prev;
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY: case MPC_TYPE_SINGLE: case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF: case MPC_TYPE_NONEOF: case MPC_TYPE_SATISFY: return 0;
+
+    case MPC_TYPE_STRING: return p->data.string.x[0] == '\0';
+
+    case MPC_TYPE_PASS: case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL: case MPC_TYPE_STATE: return 1;
+
+    /* Only its own message gets out from under an `expect` */
+    case MPC_TYPE_EXPECT:
+      s.num = 0; s.xs = NULL;
+      t.num = 0; t.xs = NULL;
+      k = mpc_dispatch_fail(p->data.expect.x, &s, &t, path);
+      mpc_dispatch_expect_clear(&s);
+      mpc_dispatch_expect_clear(&t);
+      if (k == 0) { mpc_dispatch_expect_add(ret, p->data.expect.m); }
+      return k;
+
+    case MPC_TYPE_APPLY:    return mpc_dispatch_fail(p->data.apply.x, side, ret, path);
+    case MPC_TYPE_APPLY_TO: return mpc_dispatch_fail(p->data.apply_to.x, side, ret, path);
+    case MPC_TYPE_PREDICT:  return mpc_dispatch_fail(p->data.predict.x, side, ret, path);
+    case MPC_TYPE_DFA:      return mpc_dispatch_fail(p->data.dfa.x, side, ret, path);
+    case MPC_TYPE_MEMO:     return mpc_dispatch_fail(p->data.memo.x, side, ret, path);
+
+    /* Whether a check passes depends on what matched */
+    case MPC_TYPE_CHECK:
+      k = mpc_dispatch_fail(p->data.check.x, side, ret, path);
+      return k == 1 ? -1 : k;
+
+    case MPC_TYPE_CHECK_WITH:
+      k = mpc_dispatch_fail(p->data.check_with.x, side, ret, path);
+      return k == 1 ? -1 : k;
+
+    case MPC_TYPE_MAYBE:
+      k = mpc_dispatch_fail(p->data.not.x, side, ret, path);
+      if (k == 0) { mpc_dispatch_expect_cat(side, ret); return 1; }
+      return k;
+
+    case MPC_TYPE_MANY:
+      k = mpc_dispatch_fail(p->data.repeat.x, side, ret, path);
+      if (k == 0) { mpc_dispatch_expect_cat(side, ret); return 1; }
+      return -1;
+
+    case MPC_TYPE_MANY1:
+      k = mpc_dispatch_fail(p->data.repeat.x, side, ret, path);
+      if (k == 0) { mpc_dispatch_expect_repeat(ret, "one or more of "); return 0; }
+      return -1;
+
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.n == 0) { return -1; }
+      k = mpc_dispatch_fail(p->data.repeat.x, side, ret, path);
+      if (k != 0) { return -1; }
+      sprintf(prefix, "%i of ", p->data.repeat.n);
+      mpc_dispatch_expect_repeat(ret, prefix);
+      return 0;
+
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 1; }
       for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e, depth+1)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        k = mpc_dispatch_fail(p->data.or.xs[j], side, ret, path);
+        if (k != 0) { return k; }
+        mpc_dispatch_expect_cat(side, ret);
+      }
+      return 0;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        k = mpc_dispatch_fail(p->data.and.xs[j], side, ret, path);
+        if (k != 1) { return k; }
+      }
+      return 1;
+
+    default: return -1;
+  }
+
+}
+
+static void mpc_dispatch_build(mpc_parser_t *p) {
+
+  int j, c;
+  mpc_dispatch_t *d = p->data.or.d;
+  mpc_dispatch_expect_t side, ret;
+  mpc_dispatch_path_t path;
+
+  path.p = p;
+  path.prev = NULL;
+
+  d->n = p->data.or.n;
+  d->first = calloc(d->n, 32);
+  d->fails = calloc(d->n, sizeof(mpc_dispatch_expect_t));
+
+  for (j = 0; j < d->n; j++) {
+
+    side.num = 0; side.xs = NULL;
+    ret.num = 0; ret.xs = NULL;
+
+    /* Anything that might match nothing is always tried */
+    if (!mpc_dispatch_first(p->data.or.xs[j], d->first + 32 * j, &path)
+    &&  mpc_dispatch_fail(p->data.or.xs[j], &side, &ret, &path) == 0) {
+      mpc_dispatch_expect_cat(&side, &ret);
+      d->fails[j] = side;
+    } else {
+      mpc_dispatch_expect_clear(&side);
+      mpc_dispatch_expect_clear(&ret);
+      d->fails[j].num = -1;
+    }
+  }
+
+  for (c = 0; c < 256; c++) {
+    for (j = 0; j < d->n; j++) {
+      if (d->fails[j].num < 0 || MPC_CLASS_HAS(d->first + 32 * j, c)) { break; }
+    }
+    d->start[c] = j;
+  }
+
+}
+
+static void mpc_dispatch_delete(mpc_dispatch_t *d) {
+  int j;
+  if (d == NULL) { return; }
+  for (j = 0; j < d->n; j++) { mpc_dispatch_expect_clear(&d->fails[j]); }
+  free(d->fails);
+  free(d->first);
+  free(d);
+}
+
+/* Adds what was expected to the error as `mpc_err_merge` would, but without copying it */
+static void mpc_dispatch_expect(mpc_input_t *i, mpc_err_t **e, mpc_dispatch_expect_t *x, char c) {
+
+  int j;
+
+  if (x->num == 0) { return; }
+  if (*e && (*e)->state.pos > i->state.pos) { return; }
+
+  if (*e && (*e)->state.pos == i->state.pos) {
+    if ((*e)->failure) { return; }
+  } else {
+    if (*e) { mpc_err_delete_internal(i, *e); }
+    *e = mpc_err_new(i, x->xs[0]);
+  }
+
+  for (j = 0; j < x->num; j++) {
+    if (!mpc_err_contains_expected(i, *e, x->xs[j])) {
+      mpc_err_add_expected(i, *e, x->xs[j]);
+    }
+  }
+  (*e)->received = c;
+}
+
+/* Returns the first alternative from `j` that could match the next character */
+static int mpc_dispatch_next(mpc_input_t *i, mpc_parser_t *p, int j, mpc_err_t **e) {
+
+  char c;
+  mpc_dispatch_t *d = p->data.or.d;
+
+  if (!d->n) { mpc_dispatch_build(p); }
+
+  c = mpc_input_peekc(i);
+  if (j == 0 && i->suppress) { return d->start[(unsigned char)c]; }
+
+  while (j < d->n
+  &&  d->fails[j].num >= 0
+  && !MPC_CLASS_HAS(d->first + 32 * j, c)) {
+    if (!i->suppress) { mpc_dispatch_expect(i, e, &d->fails[j], c); }
+    j++;
+  }
+
+  return j;
+}
+
+/*
+** Parse Stack
+**
+** Parsers are run off an explicit stack rather
+** than by recursion so nesting is only limited
+** by memory. Each frame is a parser being run,
+** how many of its children it has run, and where
+** its children's results start on the value stack.
+**
+** A frame is first entered, where it may finish
+** straight away or call a child, and is resumed
+** each time that child returns with its result.
+*/
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  int j;
+  int base;
+} mpc_frame_t;
+
+typedef struct {
+  int frames_num;
+  int frames_slots;
+  mpc_frame_t *frames;
+  int values_num;
+  int values_slots;
+  mpc_result_t *values;
+} mpc_stack_t;
+
+enum {
+  MPC_PARSE_STACK_MIN = 64,
+  MPC_PARSE_STALL_MAX = 4096
+};
+
+/*
+** Children never start before their parents, so
+** if the frame far enough down the stack is still
+** at this position nothing has been consumed for
+** that long and the grammar is left recursive.
+*/
+
+static int mpc_stack_call(mpc_stack_t *s, mpc_input_t *i, mpc_parser_t *p) {
+
+  mpc_frame_t *f;
+
+  if (s->frames_num >= MPC_PARSE_STALL_MAX
+  &&  s->frames[s->frames_num - MPC_PARSE_STALL_MAX].pos == i->state.pos) {
+    return 0;
+  }
+
+  if (s->frames_num == s->frames_slots) {
+    s->frames_slots *= 2;
+    s->frames = realloc(s->frames, sizeof(mpc_frame_t) * s->frames_slots);
+  }
+
+  f = &s->frames[s->frames_num++];
+  f->p = p;
+  f->pos = i->state.pos;
+  f->j = 0;
+  f->base = s->values_num;
+  return 1;
+}
+
+static void mpc_stack_push(mpc_stack_t *s, mpc_result_t x) {
+  if (s->values_num == s->values_slots) {
+    s->values_slots *= 2;
+    s->values = realloc(s->values, sizeof(mpc_result_t) * s->values_slots);
+  }
+  s->values[s->values_num++] = x;
+}
+
+#define MPC_SUCCESS(x) r->output = x; ok = 1; goto done
+#define MPC_FAILURE(x) r->error = x; ok = 0; goto done
+#define MPC_PRIMITIVE(x) \
+  if (x) { MPC_SUCCESS(r->output); } \
+  else { MPC_FAILURE(NULL); }
+#define MPC_CALL(x) \
+  if (mpc_stack_call(&s, i, x)) { enter = 1; } \
+  else { r->error = mpc_err_fail(i, "Maximum recursion depth exceeded!"); ok = 0; enter = 0; } \
+  continue
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *root, mpc_result_t *r, mpc_err_t **e) {
+
+  int k = 0, ok = 0, enter = 1;
+  mpc_frame_t *f;
+  mpc_parser_t *p;
+  mpc_result_t *xs, x;
+  mpc_memo_t *m;
+  mpc_stack_t s;
+
+  s.frames_num = 0;
+  s.frames_slots = MPC_PARSE_STACK_MIN;
+  s.frames = malloc(sizeof(mpc_frame_t) * s.frames_slots);
+  s.values_num = 0;
+  s.values_slots = MPC_PARSE_STACK_MIN;
+  s.values = malloc(sizeof(mpc_result_t) * s.values_slots);
+
+  mpc_stack_call(&s, i, root);
+
+  while (s.frames_num) {
+
+    f = &s.frames[s.frames_num-1];
+    p = f->p;
+
+    if (enter) {
+
+      switch (p->type) {
+
+        /* Basic Parsers */
+
+        case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
+        case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
+        case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
+        case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_class(i, p->data.string.m, (char**)&r->output));
+        case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_class(i, p->data.string.m, (char**)&r->output));
+        case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
+        case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+        case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+        case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
+        case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+
+        /* Regex Parsers */
+
+        case MPC_TYPE_DFA:
+          k = mpc_input_dfa(i, p->data.dfa.d, (char**)&r->output, e);
+          if (k == 1) { MPC_SUCCESS(r->output); }
+          if (k == 0 && i->suppress) { MPC_FAILURE(NULL); }
+          MPC_CALL(p->data.dfa.x);
+
+        /* Memo Parsers */
+
+        case MPC_TYPE_MEMO:
+          m = mpc_memo_find(i, p, i->state.pos, mpc_memo_mode(i));
+          if (m && m->p) {
+            i->state = m->state;
+            i->last = m->last;
+            if (m->merged) { *e = mpc_err_merge(i, *e, mpc_err_copy(i, m->merged)); }
+            if (m->ok) { MPC_SUCCESS(p->data.memo.cp(m->result.output)); }
+            else { MPC_FAILURE(mpc_err_copy(i, m->result.error)); }
+          }
+          /* Keep the running error aside to see what the parser adds to it */
+          x.error = *e;
+          mpc_stack_push(&s, x);
+          *e = NULL;
+          f->j = 1;
+          MPC_CALL(p->data.memo.x);
+
+        /* Other parsers */
+
+        case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+        case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+        case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
+        case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+        case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
+        case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+
+        /* Application Parsers */
+
+        case MPC_TYPE_APPLY:      MPC_CALL(p->data.apply.x);
+        case MPC_TYPE_APPLY_TO:   MPC_CALL(p->data.apply_to.x);
+        case MPC_TYPE_CHECK:      MPC_CALL(p->data.check.x);
+        case MPC_TYPE_CHECK_WITH: MPC_CALL(p->data.check_with.x);
+
+        case MPC_TYPE_EXPECT:
+          mpc_input_suppress_enable(i);
+          MPC_CALL(p->data.expect.x);
+
+        case MPC_TYPE_PREDICT:
+          mpc_input_backtrack_disable(i);
+          MPC_CALL(p->data.predict.x);
+
+        /* Optional Parsers */
+
+        case MPC_TYPE_NOT:
+          mpc_input_mark(i);
+          mpc_input_suppress_enable(i);
+          MPC_CALL(p->data.not.x);
+
+        case MPC_TYPE_MAYBE: MPC_CALL(p->data.not.x);
+
+        /* Repeat Parsers */
+
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1:
+          if (mpc_input_many_class(i, p, (char**)&r->output, e)) { MPC_SUCCESS(r->output); }
+          MPC_CALL(p->data.repeat.x);
+
+        case MPC_TYPE_COUNT: MPC_CALL(p->data.repeat.x);
+
+        /* Combinatory Parsers */
+
+        case MPC_TYPE_OR:
+          if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+          if (p->data.or.d) {
+            f->j = mpc_dispatch_next(i, p, 0, e);
+            if (f->j == p->data.or.n) { MPC_FAILURE(NULL); }
+          }
+          MPC_CALL(p->data.or.xs[f->j]);
+
+        case MPC_TYPE_AND:
+          if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+          mpc_input_mark(i);
+          MPC_CALL(p->data.and.xs[0]);
+
+        /* End */
+
+        default:
+          MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+      }
+
+    }
+
+    /* Resumed with the result of the child in `r` */
+
+    xs = s.values + f->base;
+
+    switch (p->type) {
+
+      case MPC_TYPE_DFA:
+        if (ok) { MPC_SUCCESS(r->output); } else { MPC_FAILURE(r->error); }
+
+      case MPC_TYPE_MEMO:
+        if (f->j == 0) {
+          if (ok) { MPC_SUCCESS(r->output); } else { MPC_FAILURE(r->error); }
+        }
+        m = mpc_memo_add(i, p, f->pos, mpc_memo_mode(i));
+        m->ok = ok;
+        m->state = i->state;
+        m->last = i->last;
+        m->merged = mpc_err_copy(i, *e);
+        if (ok) { m->result.output = p->data.memo.cp(r->output); }
+        else { m->result.error = mpc_err_copy(i, r->error); }
+        *e = *e ? mpc_err_merge(i, xs[0].error, *e) : xs[0].error;
+        if (ok) { MPC_SUCCESS(r->output); } else { MPC_FAILURE(r->error); }
+
+      /* Application Parsers */
+
+      case MPC_TYPE_APPLY:
+        if (ok) { MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output)); }
+        else { MPC_FAILURE(r->error); }
+
+      case MPC_TYPE_APPLY_TO:
+        if (ok) { MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d)); }
+        else { MPC_FAILURE(r->error); }
+
+      case MPC_TYPE_CHECK:
+        if (!ok) { MPC_FAILURE(r->error); }
+        if (p->data.check.f(&r->output)) { MPC_SUCCESS(r->output); }
+        mpc_parse_dtor(i, p->data.check.dx, r->output);
+        MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
+
+      case MPC_TYPE_CHECK_WITH:
+        if (!ok) { MPC_FAILURE(r->error); }
+        if (p->data.check_with.f(&r->output, p->data.check_with.d)) { MPC_SUCCESS(r->output); }
+        mpc_parse_dtor(i, p->data.check.dx, r->output);
+        MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
+
+      case MPC_TYPE_EXPECT:
+        mpc_input_suppress_disable(i);
+        if (ok) { MPC_SUCCESS(r->output); }
+        else { MPC_FAILURE(mpc_err_new(i, p->data.expect.m)); }
+
+      case MPC_TYPE_PREDICT:
+        mpc_input_backtrack_enable(i);
+        if (ok) { MPC_SUCCESS(r->output); } else { MPC_FAILURE(r->error); }
+
+      /* Optional Parsers */
+
+      /* TODO: Update Not Error Message */
+
+      case MPC_TYPE_NOT:
+        if (ok) {
+          mpc_input_rewind(i);
+          mpc_input_suppress_disable(i);
+          mpc_parse_dtor(i, p->data.not.dx, r->output);
+          MPC_FAILURE(mpc_err_new(i, "opposite"));
         } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
+          mpc_input_unmark(i);
+          mpc_input_suppress_disable(i);
+          MPC_SUCCESS(p->data.not.lf());
         }
-      }
 
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      case MPC_TYPE_MAYBE:
+        if (ok) { MPC_SUCCESS(r->output); }
+        *e = mpc_err_merge(i, *e, r->error);
+        MPC_SUCCESS(p->data.not.lf());
 
-    case MPC_TYPE_AND:
+      /* Repeat Parsers */
 
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+      case MPC_TYPE_MANY:
+        if (ok) { mpc_stack_push(&s, *r); f->j++; MPC_CALL(p->data.repeat.x); }
+        *e = mpc_err_merge(i, *e, r->error);
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)xs));
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      case MPC_TYPE_MANY1:
+        if (ok) { mpc_stack_push(&s, *r); f->j++; MPC_CALL(p->data.repeat.x); }
+        if (f->j == 0) { MPC_FAILURE(mpc_err_many1(i, r->error)); }
+        *e = mpc_err_merge(i, *e, r->error);
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)xs));
 
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e, depth+1)) {
+      case MPC_TYPE_COUNT:
+        if (ok) { mpc_stack_push(&s, *r); f->j++; xs = s.values + f->base; }
+        if (f->j == p->data.repeat.n) {
+          MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)xs));
+        }
+        if (ok) { MPC_CALL(p->data.repeat.x); }
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, xs[k].output);
+        }
+        MPC_FAILURE(mpc_err_count(i, r->error, p->data.repeat.n));
+
+      /* Combinatory Parsers */
+
+      case MPC_TYPE_OR:
+        if (ok) { MPC_SUCCESS(r->output); }
+        *e = mpc_err_merge(i, *e, r->error);
+        if (++f->j < p->data.or.n && p->data.or.d) { f->j = mpc_dispatch_next(i, p, f->j, e); }
+        if (f->j < p->data.or.n) { MPC_CALL(p->data.or.xs[f->j]); }
+        MPC_FAILURE(NULL);
+
+      case MPC_TYPE_AND:
+        if (!ok) {
           mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+          for (k = 0; k < f->j; k++) {
+            mpc_parse_dtor(i, p->data.and.dxs[k], xs[k].output);
           }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          MPC_FAILURE(r->error);
         }
-      }
-      mpc_input_unmark(i);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-
-    /* End */
+        mpc_stack_push(&s, *r);
+        if (++f->j < p->data.and.n) { MPC_CALL(p->data.and.xs[f->j]); }
+        mpc_input_unmark(i);
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)(s.values + f->base)));
 
-    default:
+      default: break;
+    }
 
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+    done:
+    s.values_num = s.frames[s.frames_num-1].base;
+    s.frames_num--;
+    enter = 0;
   }
 
-  return 0;
+  free(s.frames);
+  free(s.values);
+  return ok;
 
 }
 
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
+#undef MPC_CALL
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e, 0);
+  x = mpc_parse_run(i, p, r, &e);
+  mpc_memo_delete(i);
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
@@ -1368,6 +2343,98 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
   return res;
 }
 
+/*
+** Maps the file and parses it as a string, so it is
+** read on demand by the OS rather than through stdio
+** and never copied. Where there's no `mmap` this is
+** the same as `mpc_parse_contents`.
+*/
+
+int mpc_parse_mmap(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+
+#if defined(MPC_MMAP)
+  int fd, res;
+  struct stat st;
+  void *m;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) { close(fd); }
+    r->output = NULL;
+    r->error = mpc_err_file(filename, "Unable to open file!");
+    return 0;
+  }
+
+  /* Empty files can't be mapped */
+  if (st.st_size == 0) {
+    close(fd);
+    return mpc_nparse(filename, "", 0, p, r);
+  }
+
+  m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (m == MAP_FAILED) { return mpc_parse_contents(filename, p, r); }
+
+  res = mpc_nparse(filename, m, (size_t)st.st_size, p, r);
+  munmap(m, (size_t)st.st_size);
+  return res;
+#else
+  return mpc_parse_contents(filename, p, r);
+#endif
+}
+
+/*
+** Contexts
+**
+** A context holds an input between parses, so
+** many small ones don't each set up and tear
+** down its slab, marks and read window.
+*/
+
+struct mpc_context_t {
+  mpc_input_t input;
+};
+
+mpc_context_t *mpc_context_new(void) {
+  mpc_context_t *c = malloc(sizeof(mpc_context_t));
+  mpc_input_init(&c->input);
+  return c;
+}
+
+void mpc_context_delete(mpc_context_t *c) {
+  mpc_input_free(&c->input);
+  free(c);
+}
+
+int mpc_context_parse(mpc_context_t *c, const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_context_nparse(c, filename, string, strlen(string), p, r);
+}
+
+int mpc_context_nparse(mpc_context_t *c, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_open_nstring(&c->input, filename, string, length);
+  x = mpc_parse_input(&c->input, p, r);
+  mpc_input_close(&c->input);
+  return x;
+}
+
+int mpc_context_parse_file(mpc_context_t *c, const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_open_file(&c->input, filename, file);
+  x = mpc_parse_input(&c->input, p, r);
+  mpc_input_close(&c->input);
+  return x;
+}
+
+int mpc_context_parse_pipe(mpc_context_t *c, const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_open_pipe(&c->input, filename, pipe);
+  x = mpc_parse_input(&c->input, p, r);
+  mpc_input_close(&c->input);
+  return x;
+}
+
 /*
 ** Building a Parser
 */
@@ -1381,6 +2448,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  mpc_dispatch_delete(p->data.or.d);
 
 }
 
@@ -1432,6 +2500,13 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
 
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      mpc_dfa_delete(p->data.dfa.d);
+      break;
+
+    case MPC_TYPE_MEMO: mpc_undefine_unretained(p->data.memo.x, 0); break;
+
     case MPC_TYPE_CHECK:
       mpc_undefine_unretained(p->data.check.x, 0);
       free(p->data.check.e);
@@ -1543,6 +2618,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      p->data.or.d = a->data.or.d ? calloc(1, sizeof(mpc_dispatch_t)) : NULL;
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1566,6 +2642,13 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.check_with.e, a->data.check_with.e);
       break;
 
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.d = mpc_dfa_new(p->data.dfa.x);
+      break;
+
+    case MPC_TYPE_MEMO: p->data.memo.x = mpc_copy(a->data.memo.x); break;
+
     default: break;
   }
 
@@ -1767,11 +2850,21 @@ mpc_parser_t *mpc_range(char s, char e) {
   return mpc_expectf(p, "character between '%c' and '%c'", s, e);
 }
 
+/* The class is kept as a bitmap of the bytes it accepts, never including the terminator */
+static void mpc_class_bitmap(unsigned char *m, const char *s, int none) {
+  int b;
+  memset(m, 0, 32);
+  for (b = 1; b < 256; b++) {
+    if ((strchr(s, (char)b) != NULL) != none) { m[b / 8] |= 1 << (b % 8); }
+  }
+}
+
 mpc_parser_t *mpc_oneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_ONEOF;
   p->data.string.x = malloc(strlen(s) + 1);
   strcpy(p->data.string.x, s);
+  mpc_class_bitmap(p->data.string.m, s, 0);
   return mpc_expectf(p, "one of '%s'", s);
 }
 
@@ -1780,6 +2873,7 @@ mpc_parser_t *mpc_noneof(const char *s) {
   p->type = MPC_TYPE_NONEOF;
   p->data.string.x = malloc(strlen(s) + 1);
   strcpy(p->data.string.x, s);
+  mpc_class_bitmap(p->data.string.m, s, 1);
   return mpc_expectf(p, "none of '%s'", s);
 
 }
@@ -1907,6 +3001,21 @@ mpc_parser_t *mpc_maybe(mpc_parser_t *a) {
   return mpc_maybe_lift(a, mpcf_ctor_null);
 }
 
+/*
+** Memoized parsers hand out a copy of their
+** result each time so `cp` must copy a value
+** without consuming it.
+*/
+
+mpc_parser_t *mpc_memoize(mpc_parser_t *a, mpc_dtor_t da, mpc_apply_t cp) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.dx = da;
+  p->data.memo.cp = cp;
+  return p;
+}
+
 mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_MANY;
@@ -2358,6 +3467,427 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** The automaton gives the longest match while
+** the combinators are greedy and never go back
+** on a choice. These only agree when every
+** choice can be made from the next character,
+** so a regex only gets an automaton when none
+** of its alternatives start alike and nothing
+** optional or repeated can start with what may
+** follow it. Anything else, like anchors, is
+** left to the combinators.
+*/
+
+static int mpc_dfa_chars(mpc_parser_t *p, unsigned char *set) {
+
+  int b, m = 0;
+  char c;
+
+  switch (p->type) {
+    case MPC_TYPE_ANY: case MPC_TYPE_SINGLE: case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF: case MPC_TYPE_NONEOF: case MPC_TYPE_SATISFY: break;
+    default: return 0;
+  }
+
+  for (b = 1; b < 256; b++) {
+    c = (char)b;
+    switch (p->type) {
+      case MPC_TYPE_ANY:     m = 1; break;
+      case MPC_TYPE_SINGLE:  m = c == p->data.single.x; break;
+      case MPC_TYPE_RANGE:   m = c >= p->data.range.x && c <= p->data.range.y; break;
+      case MPC_TYPE_ONEOF:
+      case MPC_TYPE_NONEOF:  m = MPC_CLASS_HAS(p->data.string.m, c); break;
+      case MPC_TYPE_SATISFY: m = p->data.satisfy.f(c); break;
+      default: break;
+    }
+    if (m) { set[b / 8] |= 1 << (b % 8); }
+  }
+
+  return 1;
+}
+
+/* If `p` always reads exactly one character */
+static int mpc_dfa_single(mpc_parser_t *p) {
+
+  int j;
+  unsigned char set[32];
+
+  switch (p->type) {
+    case MPC_TYPE_EXPECT: return mpc_dfa_single(p->data.expect.x);
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 0; }
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dfa_single(p->data.or.xs[j])) { return 0; }
+      }
+      return 1;
+    default: return mpc_dfa_chars(p, set);
+  }
+
+}
+
+static int mpc_dfa_size(mpc_parser_t *p) {
+
+  int j, n, total = 0;
+  unsigned char set[32];
+
+  if (p->retained) { return -1; }
+
+  switch (p->type) {
+
+    /* Otherwise what it expects can't be given to one position */
+    case MPC_TYPE_EXPECT: return mpc_dfa_single(p->data.expect.x) ? mpc_dfa_size(p->data.expect.x) : -1;
+    case MPC_TYPE_LIFT: return p->data.lift.lf == mpcf_ctor_str ? 0 : -1;
+    case MPC_TYPE_MAYBE: return p->data.not.lf == mpcf_ctor_str ? mpc_dfa_size(p->data.not.x) : -1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      return p->data.repeat.f == mpcf_strfold ? mpc_dfa_size(p->data.repeat.x) : -1;
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return -1; }
+      for (j = 0; j < p->data.and.n; j++) {
+        n = mpc_dfa_size(p->data.and.xs[j]);
+        if (n < 0) { return -1; }
+        total += n;
+      }
+      return total;
+
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return -1; }
+      for (j = 0; j < p->data.or.n; j++) {
+        n = mpc_dfa_size(p->data.or.xs[j]);
+        if (n < 0) { return -1; }
+        total += n;
+      }
+      return total;
+
+    /* `count` doesn't give back what it read when it falls short */
+    case MPC_TYPE_COUNT: return -1;
+
+    default: return mpc_dfa_chars(p, set) ? 1 : -1;
+  }
+
+}
+
+static int mpc_dfa_first(mpc_parser_t *p, unsigned char *set) {
+
+  int j, nullable = 0;
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_dfa_first(p->data.expect.x, set);
+    case MPC_TYPE_LIFT: return 1;
+    case MPC_TYPE_MAYBE: mpc_dfa_first(p->data.not.x, set); return 1;
+    case MPC_TYPE_MANY: mpc_dfa_first(p->data.repeat.x, set); return 1;
+    case MPC_TYPE_MANY1: return mpc_dfa_first(p->data.repeat.x, set);
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_first(p->data.and.xs[j], set)) { return 0; }
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        nullable |= mpc_dfa_first(p->data.or.xs[j], set);
+      }
+      return nullable;
+
+    default: mpc_dfa_chars(p, set); return 0;
+  }
+
+}
+
+static int mpc_dfa_disjoint(const unsigned char *x, const unsigned char *y) {
+  int j;
+  for (j = 0; j < 32; j++) { if (x[j] & y[j]) { return 0; } }
+  return 1;
+}
+
+static int mpc_dfa_check(mpc_parser_t *p, const unsigned char *follow) {
+
+  int j, k, nullable = 0;
+  unsigned char first[32], all[32], next[32];
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_dfa_check(p->data.expect.x, follow);
+
+    case MPC_TYPE_MAYBE:
+      memset(first, 0, 32);
+      mpc_dfa_first(p->data.not.x, first);
+      return mpc_dfa_disjoint(first, follow)
+        && mpc_dfa_check(p->data.not.x, follow);
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      memset(first, 0, 32);
+      if (mpc_dfa_first(p->data.repeat.x, first)) { return 0; }
+      if (!mpc_dfa_disjoint(first, follow)) { return 0; }
+      for (k = 0; k < 32; k++) { next[k] = first[k] | follow[k]; }
+      return mpc_dfa_check(p->data.repeat.x, next);
+
+    case MPC_TYPE_AND:
+      memcpy(next, follow, 32);
+      for (j = p->data.and.n-1; j >= 0; j--) {
+        if (!mpc_dfa_check(p->data.and.xs[j], next)) { return 0; }
+        memset(first, 0, 32);
+        if (!mpc_dfa_first(p->data.and.xs[j], first)) { memset(next, 0, 32); }
+        for (k = 0; k < 32; k++) { next[k] |= first[k]; }
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      memset(all, 0, 32);
+      for (j = 0; j < p->data.or.n; j++) {
+        memset(first, 0, 32);
+        nullable = mpc_dfa_first(p->data.or.xs[j], first);
+        if (nullable && j < p->data.or.n-1) { return 0; }
+        if (!mpc_dfa_disjoint(first, all)) { return 0; }
+        if (!mpc_dfa_check(p->data.or.xs[j], follow)) { return 0; }
+        for (k = 0; k < 32; k++) { all[k] |= first[k]; }
+      }
+      return !nullable || mpc_dfa_disjoint(all, follow);
+
+    default: return 1;
+  }
+
+}
+
+static void mpc_dfa_link(mpc_dfa_t *d, unsigned int *from, unsigned int *to) {
+  int q, k;
+  for (q = 0; q < d->npos; q++) {
+    if (!MPC_DFA_BIT(from, q)) { continue; }
+    for (k = 0; k < d->words; k++) { d->follow[q * d->words + k] |= to[k]; }
+  }
+}
+
+/* Builds `p` into the empty sets `first` and `last`, returning if it is nullable */
+static int mpc_dfa_build(mpc_dfa_t *d, mpc_parser_t *p, unsigned int *first, unsigned int *last) {
+
+  int j, k, q, n, nullable = 0, sub;
+  unsigned int *sub_first, *sub_last;
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_dfa_build(d, p->data.expect.x, first, last);
+    case MPC_TYPE_LIFT: return 1;
+    case MPC_TYPE_MAYBE: mpc_dfa_build(d, p->data.not.x, first, last); return 1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      nullable = mpc_dfa_build(d, p->data.repeat.x, first, last);
+      mpc_dfa_link(d, last, first);
+      return p->type == MPC_TYPE_MANY ? 1 : nullable;
+
+    case MPC_TYPE_AND:
+    case MPC_TYPE_OR:
+      nullable = p->type == MPC_TYPE_AND;
+      n = p->type == MPC_TYPE_AND ? p->data.and.n : p->data.or.n;
+      sub_first = malloc(sizeof(unsigned int) * d->words);
+      sub_last = malloc(sizeof(unsigned int) * d->words);
+      for (j = 0; j < n; j++) {
+        memset(sub_first, 0, sizeof(unsigned int) * d->words);
+        memset(sub_last, 0, sizeof(unsigned int) * d->words);
+        if (p->type == MPC_TYPE_OR) {
+          nullable |= mpc_dfa_build(d, p->data.or.xs[j], sub_first, sub_last);
+          for (k = 0; k < d->words; k++) {
+            first[k] |= sub_first[k];
+            last[k] |= sub_last[k];
+          }
+          continue;
+        }
+        sub = mpc_dfa_build(d, p->data.and.xs[j], sub_first, sub_last);
+        mpc_dfa_link(d, last, sub_first);
+        for (k = 0; k < d->words; k++) {
+          if (nullable) { first[k] |= sub_first[k]; }
+          last[k] = sub ? last[k] | sub_last[k] : sub_last[k];
+        }
+        nullable = nullable && sub;
+      }
+      free(sub_first);
+      free(sub_last);
+      return nullable;
+
+    default:
+      q = d->npos++;
+      mpc_dfa_chars(p, d->chars + q * 32);
+      MPC_DFA_SET(first, q);
+      MPC_DFA_SET(last, q);
+      return 0;
+  }
+
+}
+
+static void mpc_dfa_tail_add(mpc_dfa_t *d, int q) {
+  if (d->tails_num == d->tails_slots) {
+    d->tails_slots = d->tails_slots ? d->tails_slots * 2 : 16;
+    d->tails = realloc(d->tails, sizeof(int) * d->tails_slots);
+  }
+  d->tails[d->tails_num++] = q;
+}
+
+/* Adds the positions `p` tries first in the order it tries them, returning if it is nullable */
+static int mpc_dfa_firsts(mpc_dfa_t *d, mpc_parser_t *p, int base) {
+
+  int j, nullable = 0;
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_dfa_firsts(d, p->data.expect.x, base);
+    case MPC_TYPE_LIFT: return 1;
+    case MPC_TYPE_MAYBE: mpc_dfa_firsts(d, p->data.not.x, base); return 1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      nullable = mpc_dfa_firsts(d, p->data.repeat.x, base);
+      return p->type == MPC_TYPE_MANY ? 1 : nullable;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_firsts(d, p->data.and.xs[j], base)) { return 0; }
+        base += mpc_dfa_size(p->data.and.xs[j]);
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        nullable |= mpc_dfa_firsts(d, p->data.or.xs[j], base);
+        base += mpc_dfa_size(p->data.or.xs[j]);
+      }
+      return nullable;
+
+    default:
+      mpc_dfa_tail_add(d, base);
+      return 0;
+  }
+
+}
+
+/*
+** Gives each position of `p`, numbered from `base`,
+** the positions tried after it up to the first one
+** which has to match, continuing with `tail` once
+** `p` is done.
+*/
+
+static void mpc_dfa_tails(mpc_dfa_t *d, mpc_parser_t *p, int base, const char *m, int *tail, int tail_num) {
+
+  int j, k, b, start, stop;
+  int *next;
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT:
+      mpc_dfa_tails(d, p->data.expect.x, base, m ? m : p->data.expect.m, tail, tail_num);
+      return;
+
+    case MPC_TYPE_LIFT: return;
+    case MPC_TYPE_MAYBE: mpc_dfa_tails(d, p->data.not.x, base, m, tail, tail_num); return;
+
+    /* Positions still to be numbered are built after the end of the list, then copied out */
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      start = d->tails_num;
+      mpc_dfa_firsts(d, p->data.repeat.x, base);
+      for (k = 0; k < tail_num; k++) { mpc_dfa_tail_add(d, tail[k]); }
+      next = malloc(sizeof(int) * (d->tails_num - start + 1));
+      memcpy(next, d->tails + start, sizeof(int) * (d->tails_num - start));
+      k = d->tails_num - start;
+      d->tails_num = start;
+      mpc_dfa_tails(d, p->data.repeat.x, base, m, next, k);
+      free(next);
+      return;
+
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        mpc_dfa_tails(d, p->data.or.xs[j], base, m, tail, tail_num);
+        base += mpc_dfa_size(p->data.or.xs[j]);
+      }
+      return;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        start = d->tails_num;
+        stop = 0;
+        b = base + mpc_dfa_size(p->data.and.xs[j]);
+        for (k = j+1; k < p->data.and.n && !stop; k++) {
+          stop = !mpc_dfa_firsts(d, p->data.and.xs[k], b);
+          b += mpc_dfa_size(p->data.and.xs[k]);
+        }
+        if (!stop) {
+          for (k = 0; k < tail_num; k++) { mpc_dfa_tail_add(d, tail[k]); }
+        }
+        next = malloc(sizeof(int) * (d->tails_num - start + 1));
+        memcpy(next, d->tails + start, sizeof(int) * (d->tails_num - start));
+        k = d->tails_num - start;
+        d->tails_num = start;
+        mpc_dfa_tails(d, p->data.and.xs[j], base, m, next, k);
+        free(next);
+        base += mpc_dfa_size(p->data.and.xs[j]);
+      }
+      return;
+
+    default:
+      d->expects[base] = m;
+      d->tails_at[base] = d->tails_num;
+      for (k = 0; k < tail_num; k++) { mpc_dfa_tail_add(d, tail[k]); }
+      d->tails_at[base+1] = d->tails_num;
+      return;
+  }
+
+}
+
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *x) {
+
+  int size;
+  unsigned char follow[32];
+  unsigned int *start;
+  mpc_dfa_t *d;
+
+  size = mpc_dfa_size(x);
+  if (size < 0 || size >= MPC_DFA_POS_MAX) { return NULL; }
+
+  memset(follow, 0, 32);
+  if (!mpc_dfa_check(x, follow)) { return NULL; }
+
+  /* Position zero is the start */
+  d = calloc(1, sizeof(mpc_dfa_t));
+  d->npos = 1;
+  d->words = (size + 1 + 31) / 32;
+  d->chars = calloc(size + 1, 32);
+  d->follow = calloc((size + 1) * d->words, sizeof(unsigned int));
+  d->final = calloc(d->words, sizeof(unsigned int));
+
+  if (mpc_dfa_build(d, x, d->follow, d->final)) { MPC_DFA_SET(d->final, 0); }
+
+  /* The start tries whatever the regex starts with */
+  d->expects = calloc(size + 1, sizeof(char*));
+  d->tails_at = calloc(size + 2, sizeof(int));
+  mpc_dfa_firsts(d, x, 1);
+  d->tails_at[1] = d->tails_num;
+  mpc_dfa_tails(d, x, 1, NULL, NULL, 0);
+
+  start = calloc(d->words, sizeof(unsigned int));
+  MPC_DFA_SET(start, 0);
+  mpc_dfa_state(d, start);
+  free(start);
+
+  return d;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *x) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_new(x);
+  if (d == NULL) { return x; }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = x;
+  p->data.dfa.d = d;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   return mpc_re_mode(re, MPC_RE_DEFAULT);
 }
@@ -2425,7 +3955,7 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode) {
 
   mpc_optimise(r.output);
 
-  return r.output;
+  return mpc_re_dfa(r.output);
 
 }
 
@@ -2699,6 +4229,9 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     /*mpc_print_unretained(p->data.expect.x, 0);*/
   }
 
+  if (p->type == MPC_TYPE_DFA) { mpc_print_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_MEMO) { mpc_print_unretained(p->data.memo.x, 0); }
+
   if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
   if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
 
@@ -2870,30 +4403,51 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 
 /*
 ** AST
+**
+** Trees nest as deep as the input does, which
+** is only limited by the heap, so they are
+** deleted and printed off a stack of nodes
+** rather than by recursing.
 */
 
+static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  free(a->children);
+  free(a->tag);
+  free(a->contents);
+  free(a);
+}
+
 void mpc_ast_delete(mpc_ast_t *a) {
 
-  int i;
+  int i, n = 0, slots = 64;
+  mpc_ast_t *stk[64];
+  mpc_ast_t **todo = stk;
 
   if (a == NULL) { return; }
+  todo[n++] = a;
 
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
-  }
+  while (n > 0) {
+    a = todo[--n];
 
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+    if (n + a->children_num > slots) {
+      while (n + a->children_num > slots) { slots *= 2; }
+      if (todo == stk) {
+        todo = malloc(sizeof(mpc_ast_t*) * slots);
+        memcpy(todo, stk, sizeof(mpc_ast_t*) * n);
+      } else {
+        todo = realloc(todo, sizeof(mpc_ast_t*) * slots);
+      }
+    }
 
-}
+    for (i = 0; i < a->children_num; i++) {
+      if (a->children[i]) { todo[n++] = a->children[i]; }
+    }
+
+    mpc_ast_delete_no_children(a);
+  }
+
+  if (todo != stk) { free(todo); }
 
-static void mpc_ast_delete_no_children(mpc_ast_t *a) {
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
 }
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
@@ -2914,6 +4468,25 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
 }
 
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+
+  int i;
+  mpc_ast_t *b;
+
+  if (a == NULL) { return NULL; }
+
+  b = mpc_ast_new(a->tag, a->contents);
+  b->state = a->state;
+  b->children_num = a->children_num;
+  b->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+
+  for (i = 0; i < a->children_num; i++) {
+    b->children[i] = mpc_ast_copy(a->children[i]);
+  }
+
+  return b;
+}
+
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
 
   mpc_ast_t *a = mpc_ast_new(tag, "");
@@ -2996,30 +4569,59 @@ mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
   return a;
 }
 
+typedef struct {
+  mpc_ast_t *a;
+  int d;
+} mpc_ast_print_t;
+
 static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
 
-  int i;
+  int i, n = 0, slots = 64;
+  mpc_ast_print_t stk[64];
+  mpc_ast_print_t *todo = stk;
 
-  if (a == NULL) {
-    fprintf(fp, "NULL\n");
-    return;
-  }
+  todo[n].a = a;
+  todo[n++].d = d;
 
-  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+  while (n > 0) {
+    a = todo[--n].a;
+    d = todo[n].d;
 
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag,
-      (long unsigned int)(a->state.row+1),
-      (long unsigned int)(a->state.col+1),
-      a->contents);
-  } else {
-    fprintf(fp, "%s \n", a->tag);
-  }
+    if (a == NULL) {
+      fprintf(fp, "NULL\n");
+      continue;
+    }
 
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_print_depth(a->children[i], d+1, fp);
+    for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+
+    if (strlen(a->contents)) {
+      fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag,
+        (long unsigned int)(a->state.row+1),
+        (long unsigned int)(a->state.col+1),
+        a->contents);
+    } else {
+      fprintf(fp, "%s \n", a->tag);
+    }
+
+    if (n + a->children_num > slots) {
+      while (n + a->children_num > slots) { slots *= 2; }
+      if (todo == stk) {
+        todo = malloc(sizeof(mpc_ast_print_t) * slots);
+        memcpy(todo, stk, sizeof(mpc_ast_print_t) * n);
+      } else {
+        todo = realloc(todo, sizeof(mpc_ast_print_t) * slots);
+      }
+    }
+
+    /* Pushed last first so they come off in order */
+    for (i = a->children_num - 1; i >= 0; i--) {
+      todo[n].a = a->children[i];
+      todo[n++].d = d+1;
+    }
   }
 
+  if (todo != stk) { free(todo); }
+
 }
 
 void mpc_ast_print(mpc_ast_t *a) {
@@ -3272,6 +4874,7 @@ mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
 mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
 mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
 mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_memoize(mpc_parser_t *a) { return mpc_memoize(a, (mpc_dtor_t)mpc_ast_delete, (mpc_apply_t)mpc_ast_copy); }
 
 mpc_parser_t *mpca_or(int n, ...) {
 
@@ -3651,6 +5254,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
+    if (st->flags & MPCA_LANG_PACKRAT) { stmt->grammar = mpca_memoize(stmt->grammar); }
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
     free(stmt->name);
@@ -3855,6 +5459,9 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
 
+  if (p->type == MPC_TYPE_DFA) { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_MEMO) { return 1 + mpc_nodecount_unretained(p->data.memo.x, 0); }
+
   if (p->type == MPC_TYPE_OR) {
     total = 1;
     for(i = 0; i < p->data.or.n; i++) {
@@ -3901,6 +5508,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)        { mpc_optimise_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)       { mpc_optimise_unretained(p->data.memo.x, 0); }
 
   if (p->type == MPC_TYPE_OR) {
     for(i = 0; i < p->data.or.n; i++) {
@@ -3927,6 +5536,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_dispatch_delete(t->data.or.d); mpc_dispatch_delete(p->data.or.d);
+      p->data.or.d = NULL;
       free(t->data.or.xs); free(t->name); free(t);
       continue;
     }
@@ -3941,6 +5552,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_dispatch_delete(t->data.or.d); mpc_dispatch_delete(p->data.or.d);
+      p->data.or.d = NULL;
       free(t->data.or.xs); free(t->name); free(t);
       continue;
     }
@@ -4044,6 +5657,14 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
 
+    /* Dispatch `or` on the next character */
+    if (p->type == MPC_TYPE_OR
+    &&  p->data.or.n > 1
+    && !p->data.or.d) {
+      p->data.or.d = calloc(1, sizeof(mpc_dispatch_t));
+      continue;
+    }
+
     return;
 
   }
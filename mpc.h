@@ -70,6 +70,18 @@ int mpc_nparse(const char *filename, const char *string, size_t length, mpc_pars
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_mmap(const char *filename, mpc_parser_t *p, mpc_result_t *r);
+
+struct mpc_context_t;
+typedef struct mpc_context_t mpc_context_t;
+
+mpc_context_t *mpc_context_new(void);
+void mpc_context_delete(mpc_context_t *c);
+
+int mpc_context_parse(mpc_context_t *c, const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+int mpc_context_nparse(mpc_context_t *c, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
+int mpc_context_parse_file(mpc_context_t *c, const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
+int mpc_context_parse_pipe(mpc_context_t *c, const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 
 /*
 ** Function Types
@@ -138,6 +150,7 @@ mpc_parser_t *mpc_not(mpc_parser_t *a, mpc_dtor_t da);
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf);
 mpc_parser_t *mpc_maybe(mpc_parser_t *a);
 mpc_parser_t *mpc_maybe_lift(mpc_parser_t *a, mpc_ctor_t lf);
+mpc_parser_t *mpc_memoize(mpc_parser_t *a, mpc_dtor_t da, mpc_apply_t cp);
 
 mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a);
 mpc_parser_t *mpc_many1(mpc_fold_t f, mpc_parser_t *a);
@@ -289,6 +302,7 @@ typedef struct mpc_ast_t {
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
@@ -346,6 +360,7 @@ mpc_parser_t *mpca_maybe(mpc_parser_t *a);
 mpc_parser_t *mpca_many(mpc_parser_t *a);
 mpc_parser_t *mpca_many1(mpc_parser_t *a);
 mpc_parser_t *mpca_count(int n, mpc_parser_t *a);
+mpc_parser_t *mpca_memoize(mpc_parser_t *a);
 
 mpc_parser_t *mpca_or(int n, ...);
 mpc_parser_t *mpca_and(int n, ...);
@@ -353,7 +368,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -1,7 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 #include "mpc.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifdef _WIN32
 #include <string.h>
 
@@ -31,8 +40,12 @@ void add_history(char *unused) {}
 
 struct lval;
 struct lenv;
+struct lcode;
+struct lcells;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+typedef struct lcells lcells;
 
 // this is called a function pointer
 typedef lval *(* lbuiltin)(lenv *, lval *);
@@ -40,33 +53,142 @@ typedef lval *(* lbuiltin)(lenv *, lval *);
 //you can leave lval out of the first line and just use the alias
 //except you want to reference the struct in its definition
 // like on line +10
+//
+// only the fields for the value's type are ever live, so they share a union.
+// most numbers never get here at all, see lval_num
 typedef struct lval { 
     int type;
-    long num;
-
-    char *err;
-    char *sym;
-
-    lbuiltin func;
-    lenv *env;
-    lval *formals;
-    lval *body;
-
-    // list of pointers to 'lval *' and counter of lists 
-    int count;
-    struct lval ** cell;
+    // values are shared freely and owned by the collector (see lgc_collect).
+    // nothing changes a value once it is built, except the fresh argument
+    // lists the vm hands to builtins. mark is the epoch of the last
+    // collection that reached it
+    int mark;
+
+    union {
+        long num;
+        char *err;
+        char *sym;
+
+        struct {
+            lbuiltin func;
+            lenv *env;
+            lval *formals;
+            lval *body;
+            lcode *code;
+        };
+
+        // list of pointers to 'lval *' and counter of lists. cell points
+        // at the first of count vals somewhere inside buf, which other
+        // lists may share (see lcells)
+        struct {
+            int count;
+            lcells *buf;
+            struct lval ** cell;
+        };
+    };
 } lval;
 
+// the cells of lists, shared so that tail and join need not copy: tail is
+// just a list over the same cells one further in. lo and hi bound what any
+// list may be using, so a list that ends at hi (or starts at lo) can grow
+// into the free cells past it without anyone else seeing. refs counts the
+// lists using it
+typedef struct lcells {
+    int refs;
+    int cap;
+    int lo;
+    int hi;
+    lval *cells[];
+} lcells;
+
 
 typedef struct lenv {
     lenv *par;
     int count;
     char **syms;
     lval **vals;
+    int cap;
+    int mark;
+
+    // open addressed hash index into syms/vals, holding position+1 (0 is an
+    // empty bucket). only built once an env outgrows a linear scan, which in
+    // practice is just the global env. call envs stay small and their formals
+    // are read by slot anyway
+    int *index;
+    int index_cap;
 } lenv;
 
-// enums for the int fields of out lval type
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_FUNC, LVAL_SEXPR, LVAL_QEXPR };
+#define LENV_INDEX_MIN 8
+
+// compiled form of an S-expression. the tree is flattened into a stream of
+// ints: every operand is pushed onto the vm stack in order and OP_CALL then
+// applies the top n values, the same order the tree walker evaluated them
+// in. lambda bodies are compiled once and shared by copies.
+typedef struct lcode {
+    int refs;
+    int mark;
+    int count;
+    int cap;
+    int *ops;
+    int nconsts;
+    lval **consts;
+} lcode;
+
+// OP_CONST idx       push a copy of consts[idx]
+// OP_LOCAL slot idx  push the formal bound at slot, consts[idx] is its name
+// OP_LOOKUP idx      push the value bound to symbol consts[idx]
+// OP_CALL n          apply the top n values as an evaluated S-expression
+// OP_RETURN          pop and return the top value
+enum { OP_CONST, OP_LOCAL, OP_LOOKUP, OP_CALL, OP_RETURN };
+
+// state of the hand written reader (see lread_form). it reads from a string
+// or a stream a char at a time, so a stream is never read past the end of
+// the form. tok holds the symbol or number being read, and open the lists
+// that have been started but not yet closed, innermost last
+typedef struct lreader {
+    const char *name;
+    FILE *f;
+    const char *s;
+    int row;
+    int col;
+    char *tok;
+    int ntok;
+    int tok_cap;
+    struct lval **open;
+    int nopen;
+    int open_cap;
+    char *err;
+} lreader;
+
+// interned '&', compared against formals when binding variadic arguments
+static char *lsym_rest;
+
+// what gets written besides results. set from the command line, or at
+// runtime with the 'trace' builtin. it all goes through stdout, which is
+// left buffered, and costs one flag test where it would be written
+enum { LTRACE_AST = 1, LTRACE_EVAL = 2, LTRACE_QUIET = 4 };
+static int ltrace = 0;
+
+// enums for the int fields of out lval type. LVAL_FREE marks slab blocks
+// that hold no value, it must stay 0 (see lgc_sweep)
+enum { LVAL_FREE, LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_FUNC, LVAL_SEXPR, LVAL_QEXPR };
+
+// numbers that fit in a pointer less its low bit are not allocated at all,
+// the 'lval *' is the number shifted left with the low bit set. heap lvals
+// are always aligned so their low bit is clear. such immediates are never
+// marked or swept, so always ask lval_type and lval_to_num instead of
+// poking at the struct
+#define LVAL_FIXNUM(v) ((uintptr_t) (v) & 1)
+#define LVAL_FIXNUM_MIN (INTPTR_MIN / 2)
+#define LVAL_FIXNUM_MAX (INTPTR_MAX / 2)
+
+static inline int lval_type(lval *v) {
+    return LVAL_FIXNUM(v) ? LVAL_NUM : v->type;
+}
+
+static inline long lval_to_num(lval *v) {
+    return LVAL_FIXNUM(v) ? (long) ((intptr_t) v >> 1) : v->num;
+}
 
 char *ltype_name(int t) {
     switch (t) {
@@ -85,10 +207,154 @@ char *ltype_name(int t) {
 // num then we should be fine. This was a nice addition.
 
 // enums for our possible error types: division by zero, 
-// unknown operators or numbers bigger than `long`
-enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
+// unknown operators, numbers bigger than `long` or results that overflow it
+enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM, LERR_OVERFLOW };
+
+// operators handled by builtin_op
+enum { LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_REM, LOP_EXP };
+
+// x * y into r, non zero if it did not fit
+static int lnum_mul(long x, long y, long *r) {
+#if defined(__GNUC__)
+    return __builtin_mul_overflow(x, y, r);
+#else
+    *r = (long) ((unsigned long) x * (unsigned long) y);
+    return x != 0 && ((*r / x != y) || (x == -1 && y == LONG_MIN));
+#endif
+}
+
+// x to the power y by squaring into r. a negative power truncates towards
+// zero like integer division would
+static int lnum_pow(long x, long y, long *r) {
+    if (y < 0) { *r = (x == 1 || x == -1) ? (y % 2 ? x : 1) : 0; return 0; }
+
+    *r = 1;
+    while (y) {
+        if ((y & 1) && lnum_mul(*r, x, r)) { return 1; }
+        y >>= 1;
+        // only square when there is a bit left to use it on, else 2^32
+        // squared would overflow for no reason
+        if (y && lnum_mul(x, x, &x)) { return 1; }
+    }
+    return 0;
+}
+
+// sums are kept as a 128 bit two's complement value hi:lo, so an overflow
+// can be told apart from one that cancels out later and checked once at the
+// end. the carry out of lo comes from the sign bits alone, which lets the
+// sse2 loop below do the same thing two lanes at a time
+#define LNUM_TOP (sizeof(long) * CHAR_BIT - 1)
+
+static void lnum_acc(long *hi, unsigned long *lo, long yhi, unsigned long ylo) {
+    unsigned long s = *lo + ylo;
+    *hi += yhi + (long) (((*lo & ylo) | ((*lo | ylo) & ~s)) >> LNUM_TOP);
+    *lo = s;
+}
+
+static void lnum_sum(long *y, int n, long *hi, unsigned long *lo) {
+    int i = 0;
+    *hi = 0;
+    *lo = 0;
+
+#if (defined(__AVX2__) || defined(__SSE2__)) && LONG_MAX == 0x7fffffffffffffffL
+#if defined(__AVX2__)
+#define LNUM_LANES 4
+    __m256i vlo = _mm256_setzero_si256(), vhi = _mm256_setzero_si256();
+    for (; i + LNUM_LANES <= n; i += LNUM_LANES) {
+        __m256i v = _mm256_loadu_si256((__m256i *) (y + i));
+        __m256i s = _mm256_add_epi64(vlo, v);
+        __m256i c = _mm256_or_si256(_mm256_and_si256(vlo, v),
+            _mm256_andnot_si256(s, _mm256_or_si256(vlo, v)));
+        // hi gains the carry and the sign extension of v
+        vhi = _mm256_add_epi64(vhi, _mm256_sub_epi64(
+            _mm256_srli_epi64(c, 63), _mm256_srli_epi64(v, 63)));
+        vlo = s;
+    }
+    long lanes[2][LNUM_LANES];
+    _mm256_storeu_si256((__m256i *) lanes[0], vhi);
+    _mm256_storeu_si256((__m256i *) lanes[1], vlo);
+#else
+#define LNUM_LANES 2
+    __m128i vlo = _mm_setzero_si128(), vhi = _mm_setzero_si128();
+    for (; i + LNUM_LANES <= n; i += LNUM_LANES) {
+        __m128i v = _mm_loadu_si128((__m128i *) (y + i));
+        __m128i s = _mm_add_epi64(vlo, v);
+        __m128i c = _mm_or_si128(_mm_and_si128(vlo, v),
+            _mm_andnot_si128(s, _mm_or_si128(vlo, v)));
+        vhi = _mm_add_epi64(vhi, _mm_sub_epi64(
+            _mm_srli_epi64(c, 63), _mm_srli_epi64(v, 63)));
+        vlo = s;
+    }
+    long lanes[2][LNUM_LANES];
+    _mm_storeu_si128((__m128i *) lanes[0], vhi);
+    _mm_storeu_si128((__m128i *) lanes[1], vlo);
+#endif
+    for (int l = 0; l < LNUM_LANES; l++) {
+        lnum_acc(hi, lo, lanes[0][l], (unsigned long) lanes[1][l]);
+    }
+#undef LNUM_LANES
+#endif
+
+    // whatever did not fill a vector, or all of it without simd
+    for (; i < n; i++) { lnum_acc(hi, lo, y[i] < 0 ? -1 : 0, (unsigned long) y[i]); }
+}
+
+// folds the n operands in y into x with op, returning one of the LERR_ values
+// or -1 when it worked. they are plain longs so the loops never touch an lval
+static int lnum_op(int op, long *y, int n, long *x) {
+    long hi;
+    unsigned long lo;
+
+    switch (op) {
+        case LOP_ADD:
+            lnum_sum(y, n, &hi, &lo);
+            lnum_acc(&hi, &lo, *x < 0 ? -1 : 0, (unsigned long) *x);
+            break;
+        case LOP_SUB:
+            // x minus the sum of the rest is x plus its two's complement,
+            // and with no rest at all that is just the negation of x
+            lnum_sum(y, n, &hi, &lo);
+            if (n == 0) { lnum_acc(&hi, &lo, *x < 0 ? -1 : 0, (unsigned long) *x); }
+            hi = ~hi + (lo == 0);
+            lo = ~lo + 1;
+            if (n != 0) { lnum_acc(&hi, &lo, *x < 0 ? -1 : 0, (unsigned long) *x); }
+            break;
+        case LOP_MUL:
+            // no 64 bit multiply before avx-512, so this one stays scalar
+            for (int i = 0; i < n; i++) {
+                if (lnum_mul(*x, y[i], x)) { return LERR_OVERFLOW; }
+            }
+            return -1;
+        case LOP_DIV:
+        case LOP_REM:
+            for (int i = 0; i < n; i++) {
+                if (y[i] == 0) { return LERR_DIV_ZERO; }
+                // LONG_MIN / -1 is the one quotient that does not fit
+                if (y[i] == -1) {
+                    if (op == LOP_DIV && *x == LONG_MIN) { return LERR_OVERFLOW; }
+                    *x = op == LOP_DIV ? -*x : 0;
+                } else {
+                    *x = op == LOP_DIV ? *x / y[i] : *x % y[i];
+                }
+            }
+            return -1;
+        case LOP_EXP:
+            for (int i = 0; i < n; i++) {
+                if (lnum_pow(*x, y[i], x)) { return LERR_OVERFLOW; }
+            }
+            return -1;
+        default:
+            return LERR_BAD_OP;
+    }
+
+    // the sum fits when hi is nothing but the sign of lo
+    if (hi != ((long) lo < 0 ? -1 : 0)) { return LERR_OVERFLOW; }
+    *x = (long) lo;
+    return -1;
+}
 
 lval *lenv_get(lenv *e, lval *k);
+int lenv_find(lenv *e, char *sym);
 lenv *lenv_new(void);
 lenv *lenv_copy(lenv *e);
 void lenv_add_builtin(lenv *e, char *name, lbuiltin func);
@@ -96,21 +362,38 @@ void lenv_add_builtins(lenv *e);
 void lenv_put(lenv *e, lval *k, lval *v);
 void lenv_def(lenv *e, lval *k, lval *v);
 void lenv_delete(lenv *v);
+lval *lval_alloc(int type);
+void lval_free(lval *v);
+lcells *lcells_alloc(int cap);
+void lcells_release(lcells *b);
 lval *lval_num(long x);
 lval *lval_err(char *fmt, ...);
 lval *lval_sym(char *s);
+char *lsym_intern(char *s);
 lval *lval_read_num(mpc_ast_t *t);
 lval *lval_read(mpc_ast_t *t);
+void lread_init(lreader *r, const char *name, FILE *f, const char *s);
+void lread_done(lreader *r);
+int lread_space(lreader *r);
+lval *lread_form(lreader *r);
+lval *lread_line(lreader *r);
 lval *lval_call(lenv *e, lval *v, lval *k);
 lval *lval_sexpr(void);
 lval *lval_qexpr(void);
 lval *lval_add(lval *v, lval *x);
+lval **lval_grow(lval *v, int n);
+lval **lval_grow_front(lval *v, int n);
 lval *lval_pop(lval *v, int i);
+lval *lval_slice(lval *v, int i, int n);
 lval *lval_take(lval *v, int i);
 lval *lval_eval(lenv *e, lval *v);
 lval *lval_eval_sexpr(lenv *e, lval *v);
-lval *builtin(lenv *e, lval *a, char *func);
-lval *builtin_op(lenv *e, lval* a, char* op);
+lval *lval_apply(lenv *e, lval *v);
+lcode *lcode_compile(lval *v, lval *formals);
+void lcode_delete(lcode *c);
+lval *lvm_run(lenv *e, lcode *c);
+lenv *lval_bind(lval *v, lval **args, int n, lval **r);
+lval *builtin_op(lenv *e, lval* a, int op);
 lval *builtin_head(lenv *e, lval* a);
 lval *builtin_tail(lenv *e, lval* a);
 lval *builtin_list(lenv *e, lval *a);
@@ -120,53 +403,371 @@ lval *builtin_def(lenv *e, lval *a);
 lval *builtin_var(lenv *e, lval *v, char *func);
 lval *builtin_lambda(lenv *e, lval *v);
 lval *builtin_put(lenv *e, lval *a);
+lval *builtin_trace(lenv *e, lval *a);
 lval *lval_join(lval *x, lval *y);
 lval *lval_fun(lbuiltin func);
-lval *lval_copy(lval *v);
 lval *lval_constructor(lval *formals, lval *body);
-void lval_delete(lval *v);
+void lgc_collect(void);
+int lgc_due(void);
 void lval_expr_print(lval *v, char open, char close);
 void lval_print(lval *v);
 void lval_println(lval *v);
 
 
-lval *lval_eval_sexpr(lenv *e, lval *v) {
+// applies an S-expression whose children have already been evaluated
+lval *lval_apply(lenv *e, lval *v) {
     for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-    }
-
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+        if (lval_type(v->cell[i]) == LVAL_ERR) { return lval_take(v, i); }
     }
 
     if (v->count == 0) { return v; }
     if (v->count == 1) { return lval_eval(e, lval_take(v, 0)); }
 
     lval *f = lval_pop(v, 0);
-    if (f->type != LVAL_FUNC) {
-        lval *err = lval_err(
-            "S-Expression starts with incorrect type." \
-            "Got %s, Expected %s.", ltype_name(f->type), ltype_name(LVAL_FUNC));
-        lval_delete(f);
-        lval_delete(v);
+    if (lval_type(f) != LVAL_FUNC) {
         // return lval_err("S-expression Does not start with a symbol!");
-        return err;
+        return lval_err(
+            "S-Expression starts with incorrect type." \
+            "Got %s, Expected %s.", ltype_name(lval_type(f)), ltype_name(LVAL_FUNC));
     }
 
-    lval *result = lval_call(e, f, v);
-    lval_delete(f);
+    return lval_call(e, f, v);
+}
+
+lval *lval_eval_sexpr(lenv *e, lval *v) {
+    lcode *c = lcode_compile(v, NULL);
+    lval *result = lvm_run(e, c);
+    lcode_delete(c);
     return result;
 }
 
 lval *lval_eval(lenv *e, lval *v) {
-    if (v->type == LVAL_SYM) {
-        lval *x = lenv_get(e, v);
-        lval_delete(v);
-        return x;
+    if (lval_type(v) == LVAL_SYM) { return lenv_get(e, v); }
+    if (lval_type(v) == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+    return v;
+}
+
+static void lcode_emit(lcode *c, int op) {
+    if (c->count == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->ops = realloc(c->ops, sizeof(int) * c->cap);
     }
+    c->ops[c->count++] = op;
+}
 
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-    return v;
+static int lcode_const(lcode *c, lval *v) {
+    c->nconsts++;
+    c->consts = realloc(c->consts, sizeof(lval *) * c->nconsts);
+    c->consts[c->nconsts-1] = v;
+    return c->nconsts-1;
+}
+
+// formals are bound into the call env in order (skipping '&'), so a symbol
+// naming a formal can be read straight out of that slot
+static int lcode_slot(lval *formals, char *sym) {
+    if (!formals) { return -1; }
+
+    int slot = 0;
+    for (int i = 0; i < formals->count; i++) {
+        if (formals->cell[i]->sym == lsym_rest) { continue; }
+        if (formals->cell[i]->sym == sym) { return slot; }
+        slot++;
+    }
+    return -1;
+}
+
+static void lcode_compile_expr(lcode *c, lval *v, lval *formals) {
+    switch (lval_type(v)) {
+        case LVAL_SYM: {
+            int slot = lcode_slot(formals, v->sym);
+            if (slot >= 0) {
+                lcode_emit(c, OP_LOCAL);
+                lcode_emit(c, slot);
+            } else {
+                lcode_emit(c, OP_LOOKUP);
+            }
+            lcode_emit(c, lcode_const(c, v));
+            break;
+        }
+        case LVAL_SEXPR:
+            for (int i = 0; i < v->count; i++) {
+                lcode_compile_expr(c, v->cell[i], formals);
+            }
+            lcode_emit(c, OP_CALL);
+            lcode_emit(c, v->count);
+            break;
+        default:
+            lcode_emit(c, OP_CONST);
+            lcode_emit(c, lcode_const(c, v));
+            break;
+    }
+}
+
+// compiles v as an S-expression. v may also be a Q-expression lambda body,
+// which builtin_eval would have turned into an S-expression anyway.
+lcode *lcode_compile(lval *v, lval *formals) {
+    lcode *c = malloc(sizeof(lcode));
+    c->refs = 1;
+    c->mark = 0;
+    c->count = 0;
+    c->cap = 0;
+    c->ops = NULL;
+    c->nconsts = 0;
+    c->consts = NULL;
+
+    for (int i = 0; i < v->count; i++) {
+        lcode_compile_expr(c, v->cell[i], formals);
+    }
+    lcode_emit(c, OP_CALL);
+    lcode_emit(c, v->count);
+    lcode_emit(c, OP_RETURN);
+
+    return c;
+}
+
+// the consts themselves are left to the collector
+void lcode_delete(lcode *c) {
+    if (--c->refs > 0) { return; }
+
+    free(c->consts);
+    free(c->ops);
+    free(c);
+}
+
+// operand stack shared by every (nested) run of the vm
+static lval **lvm_stack = NULL;
+static int lvm_count = 0;
+static int lvm_cap = 0;
+
+// one per lambda body (or eval'd expression) being run, innermost last.
+// calls from the vm to lambdas push a frame instead of recursing in C, and
+// a call in tail position replaces the caller's frame.
+//
+// a frame owns the envs on its env's par chain up to, not including, stop.
+// normally that is just its call env, but a tail call can only drop the
+// caller's env when the callee's formals shadow all of it (crisp looks up
+// free symbols in the caller's env), otherwise the callee keeps it on its
+// chain until it returns. along with the stack these are what the
+// collector marks from
+typedef struct lvm_frame {
+    lenv *env;
+    lenv *stop;
+    lcode *code;
+    int *ip;
+} lvm_frame;
+
+static lvm_frame *lvm_frames = NULL;
+static int lvm_nframes = 0;
+static int lvm_frames_cap = 0;
+
+// the global env, marked even when no run is in progress
+static lenv *lgc_root = NULL;
+
+static void lvm_push(lval *v) {
+    if (lvm_count == lvm_cap) {
+        lvm_cap = lvm_cap ? lvm_cap * 2 : 256;
+        lvm_stack = realloc(lvm_stack, sizeof(lval *) * lvm_cap);
+    }
+    lvm_stack[lvm_count++] = v;
+}
+
+// takes a reference to c for as long as the frame lives, the function it
+// came from may be collected while its body is still running
+static void lvm_enter(lenv *env, lenv *stop, lcode *c) {
+    if (lvm_nframes == lvm_frames_cap) {
+        lvm_frames_cap = lvm_frames_cap ? lvm_frames_cap * 2 : 64;
+        lvm_frames = realloc(lvm_frames, sizeof(lvm_frame) * lvm_frames_cap);
+    }
+
+    lvm_frame *fr = &lvm_frames[lvm_nframes++];
+    fr->env = env;
+    fr->stop = stop;
+    fr->code = c;
+    fr->ip = c->ops;
+    c->refs++;
+}
+
+static void lvm_leave(void) {
+    lvm_frame *fr = &lvm_frames[--lvm_nframes];
+
+    lenv *x = fr->env;
+    while (x != fr->stop) {
+        lenv *par = x->par;
+        lenv_delete(x);
+        x = par;
+    }
+    lcode_delete(fr->code);
+}
+
+// true if every symbol bound in b is also bound in a
+static int lenv_shadows(lenv *a, lenv *b) {
+    for (int i = 0; i < b->count; i++) {
+        if (lenv_find(a, b->syms[i]) < 0) { return 0; }
+    }
+    return 1;
+}
+
+// swaps the running code of the innermost frame for c, run in env
+static void lvm_replace(lenv *env, lcode *c) {
+    lvm_frame *fr = &lvm_frames[lvm_nframes-1];
+    lcode *old = fr->code;
+
+    c->refs++;
+    fr->env = env;
+    fr->code = c;
+    fr->ip = c->ops;
+    lcode_delete(old);
+}
+
+// starts the call of a lambda whose arguments are bound in env. in tail
+// position the current frame is replaced rather than returned to
+static void lvm_call(lenv *env, lcode *c, int tail) {
+    lvm_frame *fr = &lvm_frames[lvm_nframes-1];
+    env->par = fr->env;
+
+    if (!tail) {
+        lvm_enter(env, fr->env, c);
+        return;
+    }
+
+    if (fr->env != fr->stop && lenv_shadows(env, fr->env)) {
+        env->par = fr->env->par;
+        lenv_delete(fr->env);
+    }
+
+    // whatever else the frame owned is on env's chain now and stays owned
+    lvm_replace(env, c);
+}
+
+// writes out a call as the vm makes it, indented by how deep it is. the
+// function is named by whatever symbol it is bound to, if any
+static void ltrace_call(lenv *e, lval **args, int n) {
+    printf("%*s(", 2 * (lvm_nframes - 1), "");
+
+    char *name = NULL;
+    for (lenv *p = e; p && !name; p = p->par) {
+        for (int i = 0; i < p->count; i++) {
+            if (p->vals[i] == args[0]) { name = p->syms[i]; break; }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (i) { putchar(' '); }
+        if (i == 0 && name) { printf("%s", name); } else { lval_print(args[i]); }
+    }
+    puts(")");
+}
+
+static void ltrace_result(lval *v) {
+    printf("%*s=> ", 2 * (lvm_nframes - 1), "");
+    lval_println(v);
+}
+
+// runs c in e until it returns. lambdas called from c run in this same
+// loop, only builtins that evaluate (and a bare S-expression value) come
+// back in through here
+lval *lvm_run(lenv *e, lcode *c) {
+    int entry = lvm_nframes;
+    lvm_enter(e, e, c);
+
+    int *ip = c->ops;
+
+    while (1) {
+        switch (*ip++) {
+            case OP_CONST:
+                lvm_push(c->consts[*ip++]);
+                break;
+            case OP_LOCAL: {
+                int slot = *ip++;
+                lval *k = c->consts[*ip++];
+                // a call env only differs from the formals layout if a
+                // formal name was repeated, fall back to a named lookup
+                if (slot < e->count && e->syms[slot] == k->sym) {
+                    lvm_push(e->vals[slot]);
+                } else {
+                    lvm_push(lenv_get(e, k));
+                }
+                break;
+            }
+            case OP_LOOKUP:
+                lvm_push(lenv_get(e, c->consts[*ip++]));
+                break;
+            case OP_CALL: {
+                // the only safepoint. every live value is on the stack or
+                // reachable from a frame here, once the operands are packed
+                // into x below they are only held by C locals
+                if (lgc_due()) { lgc_collect(); }
+
+                int n = *ip++;
+                int tail = *ip == OP_RETURN;
+                lval **args = &lvm_stack[lvm_count - n];
+                if (ltrace & LTRACE_EVAL) { ltrace_call(e, args, n); }
+
+                int ok = n >= 2 && lval_type(args[0]) == LVAL_FUNC;
+                for (int i = 1; ok && i < n; i++) {
+                    if (lval_type(args[i]) == LVAL_ERR) { ok = 0; }
+                }
+
+                if (ok && !args[0]->func) {
+                    lval *r = NULL;
+                    lenv *env = lval_bind(args[0], args + 1, n - 1, &r);
+                    lvm_count -= n;
+                    if (!env) {
+                        lvm_push(r);
+                        break;
+                    }
+
+                    lvm_frames[lvm_nframes-1].ip = ip;
+                    lvm_call(env, args[0]->code, tail);
+                    e = lvm_frames[lvm_nframes-1].env;
+                    c = lvm_frames[lvm_nframes-1].code;
+                    ip = c->ops;
+                    break;
+                }
+
+                // eval is run in the current env like a call with no formals,
+                // so loops written as eval in tail position do not grow either
+                if (ok && n == 2 && args[0]->func == builtin_eval &&
+                    lval_type(args[1]) == LVAL_QEXPR) {
+                    lcode *x = lcode_compile(args[1], NULL);
+                    lvm_count -= n;
+
+                    lvm_frames[lvm_nframes-1].ip = ip;
+                    if (tail) {
+                        lvm_replace(e, x);
+                    } else {
+                        lvm_enter(e, e, x);
+                    }
+                    lcode_delete(x);
+
+                    c = x;
+                    ip = c->ops;
+                    break;
+                }
+
+                // move the operands off the stack before applying, a nested
+                // run may grow (and so move) the stack
+                lval *x = lval_sexpr();
+                if (n) { memcpy(lval_grow(x, n), args, sizeof(lval *) * n); }
+                lvm_count -= n;
+                lvm_push(lval_apply(e, x));
+                if (ltrace & LTRACE_EVAL) { ltrace_result(lvm_stack[lvm_count-1]); }
+                break;
+            }
+            case OP_RETURN: {
+                lvm_leave();
+                if (lvm_nframes == entry) {
+                    return lvm_stack[--lvm_count];
+                }
+
+                lvm_frame *fr = &lvm_frames[lvm_nframes-1];
+                e = fr->env;
+                c = fr->code;
+                ip = fr->ip;
+                break;
+            }
+        }
+    }
 }
  
 int count_leaves(mpc_ast_t *t) {
@@ -184,58 +785,243 @@ int count_leaves(mpc_ast_t *t) {
     return 0;
 }
 
-int main(int argc, char** argv) {
-
-    mpc_parser_t *Number = mpc_new("number");
-    mpc_parser_t *Symbol = mpc_new("symbol");
-    mpc_parser_t *Sexpr = mpc_new("sexpr");
-    mpc_parser_t *Qexpr = mpc_new("qexpr");
-    mpc_parser_t *Expr = mpc_new("expr");
-    mpc_parser_t *Crisp = mpc_new("crisp");
+// the grammar is only built the first time input goes through mpc. that
+// takes mpca_lang parsing the text below, and mpc_re compiling each regex
+// in it with a grammar of its own, which would otherwise be most of what
+// starting up costs. every line and form is parsed in the one context so
+// none of them set up mpc's input state from scratch
+static mpc_parser_t *Number, *Symbol, *Sexpr, *Qexpr, *Expr, *Form, *Crisp;
+static mpc_context_t *Ctx;
+
+static void lgrammar(void) {
+    if (Crisp) { return; }
+
+    Number = mpc_new("number");
+    Symbol = mpc_new("symbol");
+    Sexpr = mpc_new("sexpr");
+    Qexpr = mpc_new("qexpr");
+    Expr = mpc_new("expr");
+    Form = mpc_new("form");
+    Crisp = mpc_new("crisp");
+    Ctx = mpc_context_new();
 
     mpca_lang(MPCA_LANG_DEFAULT,
     "                                                                                                          \
         number   : /-?[0-9]+/ ;                                                                                \
-        symbol   : '+' | '-' | '*' | '/' | '%' | '^' | /add/ | /sub/ | /mul/ | /div/ | /rem/ | /exp/           \
-                 | /list/ | /head/ | /tail/ | /join/ | /eval/ | /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;             \
+        symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%^]+/ ;                                                        \
         sexpr    : '(' <expr>* ')' ;                                                                           \
         qexpr    : '{' <expr>* '}';                                                                            \
         expr     : <number> | <symbol> | <sexpr> | <qexpr> ;                                                   \
+        form     : /\\s*/ <expr> | /\\s*$/ ;                                                                   \
         crisp    : /^/ <expr>* /$/ ;                                                                           \
     ",
-    Number, Symbol, Sexpr, Qexpr, Expr, Crisp);
+    Number, Symbol, Sexpr, Qexpr, Expr, Form, Crisp);
+}
+
+static void lgrammar_cleanup(void) {
+    if (Crisp) {
+        mpc_cleanup(7, Number, Symbol, Sexpr, Qexpr, Expr, Form, Crisp);
+        mpc_context_delete(Ctx);
+    }
+}
+
+// evaluates one form and prints what it came to. errors are printed even
+// when quiet
+void lrun_eval(lenv *e, lval *x) {
+    lval *result = lval_eval(e, x);
+    if (!(ltrace & LTRACE_QUIET) || lval_type(result) == LVAL_ERR) {
+        lval_println(result);
+    }
+}
+
+// input goes through mpc and its AST when asked to with --mpc. otherwise
+// the reader takes it, whatever is being traced
+static int lmpc = 0;
+
+// the reader has no AST to trace, so the form it read is dumped instead in
+// the shape mpc_ast_print gives the grammar's
+static void ltrace_form(lval *v, int depth) {
+    printf("%*s", 2 * depth, "");
+    switch (lval_type(v)) {
+        case LVAL_NUM: printf("number '%li'\n", lval_to_num(v)); break;
+        case LVAL_SYM: printf("symbol '%s'\n", v->sym); break;
+        case LVAL_ERR: printf("error '%s'\n", v->err); break;
+        default:
+            puts(lval_type(v) == LVAL_SEXPR ? "sexpr" : "qexpr");
+            for (int i = 0; i < v->count; i++) {
+                ltrace_form(v->cell[i], depth + 1);
+            }
+    }
+}
+
+// the reader path
+void lrun_read(lenv *e, lval *x) {
+    if (ltrace & LTRACE_AST) { ltrace_form(x, 0); }
+    lrun_eval(e, x);
+}
+
+// the mpc path. the AST is traced if asked to, then read into lvals
+void lrun_form(lenv *e, mpc_ast_t *t) {
+    if (ltrace & LTRACE_AST) {
+        printf("Tag: %s\n", t->tag);
+        printf("Contents: %p\n", (void *) t->children);
+        printf("Number of children: %i\n", t->children_num);
+        mpc_ast_print(t);
+    }
+
+    // a lone form comes back wrapped in a root node (with the /^/ and /$/
+    // matches in the repl). it evaluates the same without the S-expression
+    // that would make of it, and traces without the extra call
+    if (strcmp(t->tag, ">") == 0) {
+        mpc_ast_t *form = NULL;
+        int forms = 0;
+        for (int i = 0; i < t->children_num; i++) {
+            if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
+            form = t->children[i];
+            forms++;
+        }
+        if (forms == 1) { t = form; }
+    }
+
+    lrun_eval(e, lval_read(t));
+}
+
+// runs the top level forms of a script one at a time, each is evaluated as
+// soon as it has been read so input of any size is never held whole. "-"
+// reads stdin. with mpc, files are parsed in place and anything else goes
+// through its pipe input, which keeps what it read past a form in Ctx for
+// the next parse. the stream is then only read through mpc, and its end
+// parses as a form with nothing in it
+int lrun_script(lenv *e, char *name) {
+    int pipe = strcmp(name, "-") == 0;
+    FILE *f = pipe ? stdin : fopen(name, "rb");
+    if (!f) {
+        fprintf(stderr, "Could not open '%s'.\n", name);
+        return 1;
+    }
+
+    lreader rd;
+    lread_init(&rd, name, f, NULL);
+
+    int status = 0;
+    while (1) {
+        if (!lmpc) {
+            // skip to the next form, or stop at the end of the input
+            if (lread_space(&rd) == EOF) { break; }
+
+            lval *x = lread_form(&rd);
+            if (!x) {
+                puts(rd.err);
+                status = 1;
+                break;
+            }
+
+            lrun_read(e, x);
+            continue;
+        }
+
+        lgrammar();
+        mpc_result_t r;
+        int ok = pipe
+            ? mpc_context_parse_pipe(Ctx, name, f, Form, &r)
+            : mpc_context_parse_file(Ctx, name, f, Form, &r);
+
+        if (!ok) {
+            // there is no telling where the next form starts
+            mpc_err_print(r.error);
+            mpc_err_delete(r.error);
+            status = 1;
+            break;
+        }
+
+        mpc_ast_t *t = r.output;
+        if (t->children_num == 0) {
+            mpc_ast_delete(t);
+            break;
+        }
+
+        lrun_form(e, t);
+        mpc_ast_delete(r.output);
+    }
 
-    puts("Crisp Version 0.0.0.0.2\n");
-    puts("Press Ctrl+C to Exit\n");
+    lread_done(&rd);
+    if (!pipe) { fclose(f); }
+    return status;
+}
+
+int main(int argc, char** argv) {
+    // options come first, anything after them is a script to run
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--trace-ast") == 0) {
+            ltrace |= LTRACE_AST;
+        } else if (strcmp(argv[arg], "--trace-eval") == 0) {
+            ltrace |= LTRACE_EVAL;
+        } else if (strcmp(argv[arg], "--quiet") == 0) {
+            ltrace |= LTRACE_QUIET;
+        } else if (strcmp(argv[arg], "--mpc") == 0) {
+            lmpc = 1;
+        } else {
+            fprintf(stderr, "Unknown option '%s'.\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    lsym_rest = lsym_intern("&");
 
     lenv *e = lenv_new();
     lenv_add_builtins(e);
+    lgc_root = e;
+
+    // scripts run in order in the one env, no repl after them. nobody is
+    // waiting on each line so stdout is flushed in big blocks
+    if (arg < argc) {
+        static char out[1 << 16];
+        setvbuf(stdout, out, _IOFBF, sizeof(out));
+
+        int status = 0;
+        for (int i = arg; i < argc && !status; i++) {
+            status = lrun_script(e, argv[i]);
+        }
+
+        lenv_delete(e);
+        lgrammar_cleanup();
+        return status;
+    }
+
+    if (!(ltrace & LTRACE_QUIET)) {
+        puts("Crisp Version 0.0.0.0.2\n");
+        puts("Press Ctrl+C to Exit\n");
+    }
 
     while (1) {
-        // init prompt and read input
-        char *prompt = "crisp>>> \n";
+        // init prompt and read input, stop at the end of it. quiet leaves
+        // the prompt out too so only results and errors are printed
+        char *prompt = (ltrace & LTRACE_QUIET) ? "" : "crisp>>> \n";
         char *input = readline(prompt);
+        if (!input) { break; }
         add_history(input);
 
-        // parse input
+        // read input
+        if (!lmpc) {
+            lreader rd;
+            lread_init(&rd, "<stdin>", NULL, input);
+            lval *x = lread_line(&rd);
+            if (x) {
+                lrun_read(e, x);
+            } else {
+                puts(rd.err);
+            }
+            lread_done(&rd);
+            free(input);
+            continue;
+        }
+
+        // or parse it against the grammar
+        lgrammar();
         mpc_result_t r;
-        if (mpc_parse("<stdin>", input, Crisp, &r)) {
-            // ast
-            mpc_ast_t *a = r.output;
-            printf("Tag: %s\n", a->tag);
-            printf("Contents: %p\n", (void *) a->children);
-            printf("Number of children: %i\n", a->children_num);
-            // printf("State: %s", a->state[0]);
-            mpc_ast_print(r.output);
-            
-            // ast to s-expr
-            // lval *x = lval_read(r.output);
-            // lval_println(x);
-            // lval_delete(x);
-
-            lval *result = lval_eval(e, lval_read(r.output));
-            lval_println(result);
-            lval_delete(result);
+        if (mpc_context_parse(Ctx, "<stdin>", input, Crisp, &r)) {
+            lrun_form(e, r.output);
             mpc_ast_delete(r.output);
         } else {
             mpc_err_print(r.error);
@@ -248,22 +1034,260 @@ int main(int argc, char** argv) {
 
     lenv_delete(e);
 
-    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Crisp);
+    lgrammar_cleanup();
 
     return 0;
 }
 
+// fixed size block allocator. blocks are carved out of big chunks and
+// recycled through an intrusive free list, chunks are kept for the life of
+// the process since the same sizes keep getting asked for. link is where
+// in a block the free list pointer goes, so a slab's users can keep their
+// own bookkeeping at the front of free blocks. chunks are zeroed and
+// remembered so the collector can walk every block
+#define LSLAB_CHUNK 65536
+
+typedef struct lslab {
+    size_t size;
+    size_t link;
+    void *free;
+    char **chunks;
+    int nchunks;
+} lslab;
+
+static void *lslab_alloc(lslab *s) {
+    if (!s->free) {
+        int n = LSLAB_CHUNK / s->size;
+        char *chunk = calloc(n, s->size);
+        for (int i = n-1; i >= 0; i--) {
+            *(void **) (chunk + i * s->size + s->link) = s->free;
+            s->free = chunk + i * s->size;
+        }
+
+        s->nchunks++;
+        s->chunks = realloc(s->chunks, sizeof(char *) * s->nchunks);
+        s->chunks[s->nchunks-1] = chunk;
+    }
+
+    void *p = s->free;
+    s->free = *(void **) ((char *) p + s->link);
+    return p;
+}
+
+static void lslab_free(lslab *s, void *p) {
+    *(void **) ((char *) p + s->link) = s->free;
+    s->free = p;
+}
+
+static lslab lval_slab = { .size = sizeof(lval), .link = offsetof(lval, num) };
+static lslab lenv_slab = { .size = sizeof(lenv), .link = 0 };
+
+// cell buffers come in size classes of 4, 8, 16 and 32 pointers, anything
+// bigger goes to malloc
+#define LCELLS_CLASSES 4
+#define LCELLS_SIZE(cap) (sizeof(lcells) + sizeof(lval *) * (cap))
+static lslab lcells_slab[LCELLS_CLASSES] = {
+    { .size = LCELLS_SIZE(4), .link = 0 },
+    { .size = LCELLS_SIZE(8), .link = 0 },
+    { .size = LCELLS_SIZE(16), .link = 0 },
+    { .size = LCELLS_SIZE(32), .link = 0 },
+};
+
+static int lcells_class(int cap) {
+    for (int i = 0; i < LCELLS_CLASSES; i++) {
+        if (cap <= (4 << i)) { return i; }
+    }
+    return -1;
+}
+
+// a buffer of at least cap cells, empty and with one ref for the caller
+lcells *lcells_alloc(int cap) {
+    int i = lcells_class(cap);
+    lcells *b;
+    if (i >= 0) {
+        b = lslab_alloc(&lcells_slab[i]);
+        cap = 4 << i;
+    } else {
+        b = malloc(LCELLS_SIZE(cap));
+    }
+
+    b->refs = 1;
+    b->cap = cap;
+    b->lo = 0;
+    b->hi = 0;
+    return b;
+}
+
+void lcells_release(lcells *b) {
+    if (!b || --b->refs) { return; }
+
+    int i = lcells_class(b->cap);
+    if (i >= 0) {
+        lslab_free(&lcells_slab[i], b);
+    } else {
+        free(b);
+    }
+}
+
+// mark and sweep collector. the roots are the global env and, for every
+// run of the vm in progress, its operand stack, env and code. anything
+// they do not reach is garbage, cycles included. every heap lval lives in
+// lval_slab, so the sweep just walks its chunks.
+//
+// collection only happens at the vm's safepoint (see OP_CALL), where no
+// live value is held only by a C local. builtins can therefore build and
+// share values without any bookkeeping. a collection is due once as many
+// lvals have been allocated as survived the last one, and at least
+// LGC_MIN of them
+#define LGC_MIN 65536
+
+static int lgc_epoch = 0;
+static long lgc_allocs = 0;
+static long lgc_live = 0;
+
+static lval **lgc_grey = NULL;
+static int lgc_ngrey = 0;
+static int lgc_grey_cap = 0;
+
+static void lgc_mark(lval *v) {
+    if (LVAL_FIXNUM(v) || v->mark == lgc_epoch) { return; }
+    v->mark = lgc_epoch;
+
+    // children are traced from an explicit stack, lists can nest deeper
+    // than the C stack would like
+    if (lgc_ngrey == lgc_grey_cap) {
+        lgc_grey_cap = lgc_grey_cap ? lgc_grey_cap * 2 : 1024;
+        lgc_grey = realloc(lgc_grey, sizeof(lval *) * lgc_grey_cap);
+    }
+    lgc_grey[lgc_ngrey++] = v;
+}
+
+static void lgc_mark_env(lenv *e) {
+    for (; e && e->mark != lgc_epoch; e = e->par) {
+        e->mark = lgc_epoch;
+        for (int i = 0; i < e->count; i++) {
+            lgc_mark(e->vals[i]);
+        }
+    }
+}
+
+static void lgc_mark_code(lcode *c) {
+    if (c->mark == lgc_epoch) { return; }
+    c->mark = lgc_epoch;
+    for (int i = 0; i < c->nconsts; i++) {
+        lgc_mark(c->consts[i]);
+    }
+}
+
+static void lgc_trace(void) {
+    while (lgc_ngrey) {
+        lval *v = lgc_grey[--lgc_ngrey];
+
+        switch (v->type) {
+            case LVAL_FUNC:
+                if (!v->func) {
+                    lgc_mark_env(v->env);
+                    lgc_mark(v->formals);
+                    lgc_mark(v->body);
+                    lgc_mark_code(v->code);
+                }
+                break;
+            case LVAL_SEXPR:
+            case LVAL_QEXPR:
+                for (int i = 0; i < v->count; i++) {
+                    lgc_mark(v->cell[i]);
+                }
+                break;
+        }
+    }
+}
+
+// releases what an unreachable lval owns besides other lvals
+static void lgc_finalize(lval *v) {
+    switch (v->type) {
+        case LVAL_FUNC:
+            if (!v->func) {
+                lenv_delete(v->env);
+                lcode_delete(v->code);
+            }
+            break;
+        case LVAL_ERR: 
+            free(v->err); 
+            break;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            lcells_release(v->buf);
+        break;
+    }
+
+    lval_free(v);
+}
+
+static void lgc_sweep(void) {
+    int n = LSLAB_CHUNK / lval_slab.size;
+    lgc_live = 0;
+
+    for (int c = 0; c < lval_slab.nchunks; c++) {
+        lval *block = (lval *) lval_slab.chunks[c];
+        for (int i = 0; i < n; i++) {
+            lval *v = &block[i];
+            if (v->type == LVAL_FREE) { continue; }
+            if (v->mark == lgc_epoch) {
+                lgc_live++;
+            } else {
+                lgc_finalize(v);
+            }
+        }
+    }
+}
+
+int lgc_due(void) {
+    return lgc_allocs >= LGC_MIN && lgc_allocs >= lgc_live;
+}
+
+void lgc_collect(void) {
+    lgc_epoch++;
+
+    if (lgc_root) { lgc_mark_env(lgc_root); }
+    for (int i = 0; i < lvm_count; i++) {
+        lgc_mark(lvm_stack[i]);
+    }
+    for (int i = 0; i < lvm_nframes; i++) {
+        lgc_mark_env(lvm_frames[i].env);
+        lgc_mark_code(lvm_frames[i].code);
+    }
+
+    lgc_trace();
+    lgc_sweep();
+    lgc_allocs = 0;
+}
+
+lval *lval_alloc(int type) {
+    lval *v = lslab_alloc(&lval_slab);
+    v->type = type;
+    v->mark = 0;
+    lgc_allocs++;
+    return v;
+}
+
+void lval_free(lval *v) {
+    v->type = LVAL_FREE;
+    lslab_free(&lval_slab, v);
+}
+
 lval *lval_num(long x) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+        return (lval *) (((uintptr_t) (intptr_t) x << 1) | 1);
+    }
+
+    lval *v = lval_alloc(LVAL_NUM);
     v->num = x;
 
     return v;
 }
 
 lval *lval_err(char *fmt, ...) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval *v = lval_alloc(LVAL_ERR);
     // v->err = malloc(strlen(fmt) + 1);
 
     // create list va and initialize
@@ -285,29 +1309,74 @@ lval *lval_err(char *fmt, ...) {
     return v;
 }
 
+// every symbol name lives once in the intern table, so symbols (and env
+// keys) can be compared by pointer and are never copied or freed
+static char **lsym_table = NULL;
+static int lsym_count = 0;
+static int lsym_cap = 0;
+
+static unsigned long lsym_hash(char *s) {
+    // FNV-1a
+    unsigned long h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void lsym_grow(void) {
+    int cap = lsym_cap ? lsym_cap * 2 : 256;
+    char **table = calloc(cap, sizeof(char *));
+
+    for (int i = 0; i < lsym_cap; i++) {
+        if (!lsym_table[i]) { continue; }
+        int h = lsym_hash(lsym_table[i]) & (cap - 1);
+        while (table[h]) { h = (h + 1) & (cap - 1); }
+        table[h] = lsym_table[i];
+    }
+
+    free(lsym_table);
+    lsym_table = table;
+    lsym_cap = cap;
+}
+
+char *lsym_intern(char *s) {
+    if (lsym_count * 2 >= lsym_cap) { lsym_grow(); }
+
+    int mask = lsym_cap - 1;
+    int h = lsym_hash(s) & mask;
+    while (lsym_table[h]) {
+        if (strcmp(lsym_table[h], s) == 0) { return lsym_table[h]; }
+        h = (h + 1) & mask;
+    }
+
+    lsym_table[h] = malloc(strlen(s) + 1);
+    strcpy(lsym_table[h], s);
+    lsym_count++;
+    return lsym_table[h];
+}
+
 lval *lval_sym(char *s) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    // why do we do this instead of just assigning
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    lval *v = lval_alloc(LVAL_SYM);
+    v->sym = lsym_intern(s);
 
     return v;
 }
 
 lval *lval_sexpr(void) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval *v = lval_alloc(LVAL_SEXPR);
     v->count = 0;
+    v->buf = NULL;
     v->cell = NULL;
 
     return v;
 }
 
 lval *lval_qexpr(void) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval *v = lval_alloc(LVAL_QEXPR);
     v->count = 0;
+    v->buf = NULL;
     v->cell = NULL;
 
     return v;
@@ -320,173 +1389,439 @@ lval *lval_read_num(mpc_ast_t *t) {
         lval_num(x) : lval_err("invalid number '%s'", t->contents);
 }
 
-lval *lval_read(mpc_ast_t *t) {
+// the number or symbol at t, or NULL if t is a list
+static lval *lval_read_atom(mpc_ast_t *t) {
     if (strstr(t->tag, "number")) { return lval_read_num(t); }
     if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+    return NULL;
+}
 
+static lval *lval_read_list(mpc_ast_t *t) {
     lval *x = NULL;
     if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
     if (strstr(t->tag, "sexpr")) { x = lval_sexpr(); }
     if (strstr(t->tag, "qexpr")) { x = lval_qexpr(); }
+    return x;
+}
+
+// brackets and the /^/ and /$/ matches are in the AST but not the lists
+static int lval_read_skip(mpc_ast_t *t) {
+    return strcmp(t->contents, "(") == 0 || strcmp(t->contents, ")") == 0
+        || strcmp(t->contents, "{") == 0 || strcmp(t->contents, "}") == 0
+        || strcmp(t->tag, "regex") == 0;
+}
+
+// a list being read out of the AST, and its next child to read
+typedef struct lval_read_frame {
+    mpc_ast_t *t;
+    lval *x;
+    int i;
+} lval_read_frame;
+
+// the AST nests as deep as the input, so the lists still being filled are
+// kept on a stack of their own, as the reader does, rather than recursing
+lval *lval_read(mpc_ast_t *t) {
+    lval *v = lval_read_atom(t);
+    if (v) { return v; }
+
+    int n = 0, cap = 64;
+    lval_read_frame *open = malloc(sizeof(lval_read_frame) * cap);
+    open[n++] = (lval_read_frame) { t, lval_read_list(t), 0 };
+
+    while (1) {
+        lval_read_frame *f = &open[n-1];
+        if (f->i == f->t->children_num) {
+            lval *x = f->x;
+            if (--n == 0) {
+                free(open);
+                return x;
+            }
+            lval_add(open[n-1].x, x);
+            continue;
+        }
+
+        mpc_ast_t *c = f->t->children[f->i++];
+        if (lval_read_skip(c)) { continue; }
+        if ((v = lval_read_atom(c))) {
+            lval_add(f->x, v);
+            continue;
+        }
 
-    for (int i = 0; i < t->children_num; i++) {
-        if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-        if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
-        x = lval_add(x, lval_read(t->children[i]));
+        if (n == cap) {
+            cap *= 2;
+            open = realloc(open, sizeof(lval_read_frame) * cap);
+        }
+        open[n++] = (lval_read_frame) { c, lval_read_list(c), 0 };
     }
+}
 
-    return x;
+// the reader goes straight from bytes to lvals, without the AST mpc builds
+// and lval_read then picks apart. it reads the same language as the grammar
+// in lgrammar, which --mpc parses input with instead
+void lread_init(lreader *r, const char *name, FILE *f, const char *s) {
+    r->name = name;
+    r->f = f;
+    r->s = s;
+    r->row = 1;
+    r->col = 1;
+    r->tok = NULL;
+    r->ntok = 0;
+    r->tok_cap = 0;
+    r->open = NULL;
+    r->nopen = 0;
+    r->open_cap = 0;
+    r->err = NULL;
+}
+
+void lread_done(lreader *r) {
+    free(r->tok);
+    free(r->open);
+    free(r->err);
+}
+
+static int lread_peek(lreader *r) {
+    if (!r->f) { return *r->s ? (unsigned char) *r->s : EOF; }
+
+    int c = getc(r->f);
+    if (c != EOF) { ungetc(c, r->f); }
+    return c;
+}
+
+static int lread_next(lreader *r) {
+    int c = r->f ? getc(r->f) : (*r->s ? (unsigned char) *r->s++ : EOF);
+    if (c == '\n') {
+        r->row++;
+        r->col = 1;
+    } else if (c != EOF) {
+        r->col++;
+    }
+    return c;
+}
+
+// formats like mpc's errors, with the position the reader got to
+static lval *lread_error(lreader *r, char *fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    char what[512];
+    vsnprintf(what, sizeof(what), fmt, va);
+    va_end(va);
+
+    size_t n = strlen(r->name) + strlen(what) + 64;
+    free(r->err);
+    r->err = malloc(n);
+    snprintf(r->err, n, "%s:%i:%i: error: %s", r->name, r->row, r->col, what);
+    return NULL;
+}
+
+// skips whitespace, returns the char after it without reading it
+int lread_space(lreader *r) {
+    int c;
+    while ((c = lread_peek(r)) != EOF && isspace(c)) { lread_next(r); }
+    return c;
+}
+
+static int lread_symchar(int c) {
+    return c != EOF && (isalnum(c) || strchr("_+-*/\\=<>!&%^", c));
+}
+
+static void lread_tok(lreader *r, int c) {
+    if (r->ntok + 1 >= r->tok_cap) {
+        r->tok_cap = r->tok_cap ? r->tok_cap * 2 : 64;
+        r->tok = realloc(r->tok, r->tok_cap);
+    }
+    r->tok[r->ntok++] = c;
+    r->tok[r->ntok] = '\0';
+}
+
+static void lread_open(lreader *r, lval *x) {
+    if (r->nopen == r->open_cap) {
+        r->open_cap = r->open_cap ? r->open_cap * 2 : 64;
+        r->open = realloc(r->open, sizeof(lval *) * r->open_cap);
+    }
+    r->open[r->nopen++] = x;
+}
+
+// reads a number or a symbol starting with c
+static lval *lread_atom(lreader *r, int c) {
+    if (c == EOF) { return lread_error(r, "expected expression at end of input"); }
+    if (!lread_symchar(c)) { return lread_error(r, "unexpected '%c'", c); }
+
+    // a number is an optional '-' and digits, as /-?[0-9]+/ in the grammar.
+    // anything else made of symbol chars is a symbol
+    r->ntok = 0;
+    lread_tok(r, lread_next(r));
+    if (r->tok[0] == '-' || isdigit(c)) {
+        int digits = isdigit(c);
+        while ((c = lread_peek(r)) != EOF && isdigit(c)) {
+            lread_tok(r, lread_next(r));
+            digits = 1;
+        }
+        if (digits) {
+            errno = 0;
+            long x = strtol(r->tok, NULL, 10);
+            return errno != ERANGE ?
+                lval_num(x) : lval_err("invalid number '%s'", r->tok);
+        }
+    }
+
+    while (lread_symchar(lread_peek(r))) { lread_tok(r, lread_next(r)); }
+    return lval_sym(r->tok);
+}
+
+// reads the form at r, after any whitespace. returns NULL and sets r->err if
+// the input is not a form. lists are read in a loop over r->open rather than
+// by recursing, so how deep they nest is only limited by memory
+lval *lread_form(lreader *r) {
+    r->nopen = 0;
+
+    while (1) {
+        int c = lread_space(r);
+        if (c == '(' || c == '{') {
+            lread_next(r);
+            lread_open(r, c == '(' ? lval_sexpr() : lval_qexpr());
+            continue;
+        }
+
+        lval *v;
+        if (r->nopen) {
+            int close = lval_type(r->open[r->nopen-1]) == LVAL_SEXPR ? ')' : '}';
+            if (c == EOF) {
+                return lread_error(r, "expected '%c' at end of input", close);
+            }
+            if (c == close) {
+                lread_next(r);
+                v = r->open[--r->nopen];
+            } else if (!(v = lread_atom(r, c))) {
+                return NULL;
+            }
+        } else if (!(v = lread_atom(r, c))) {
+            return NULL;
+        }
+
+        if (!r->nopen) { return v; }
+        lval_add(r->open[r->nopen-1], v);
+    }
+}
+
+// reads all of the forms in r as a repl line does, into one S-expression.
+// a lone form is returned as it is, it evaluates the same
+lval *lread_line(lreader *r) {
+    lval *x = lval_sexpr();
+    while (lread_space(r) != EOF) {
+        lval *v = lread_form(r);
+        if (!v) { return NULL; }
+        lval_add(x, v);
+    }
+
+    return x->count == 1 ? x->cell[0] : x;
 }
 
 lval *lval_call(lenv *e, lval *v, lval *k) {
     if (v->func) { return v->func(e, k); }
 
-    int given = k->count;
+    lval *r = NULL;
+    lenv *env = lval_bind(v, k->cell, k->count, &r);
+    if (!env) { return r; }
+
+    env->par = e;
+    r = lvm_run(env, v->code);
+    lenv_delete(env);
+    return r;
+}
+
+// binds n args to the formals of lambda v. returns the env to run its body
+// in, with par left to the caller. otherwise returns NULL and sets *r to
+// an error, or to a new function over the remaining formals if v was only
+// partially applied
+lenv *lval_bind(lval *v, lval **args, int n, lval **r) {
+    int given = n;
     int total = v->formals->count;
 
-    while (k->count) {
-        if (v->formals->count == 0) {
-            lval_delete(k);
-            return lval_err(
+    // v may be shared so it is left untouched, arguments are bound into a
+    // copy of its env and formals are walked with an index instead of popped
+    lenv *env = lenv_copy(v->env);
+    int f = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (f == v->formals->count) {
+            lenv_delete(env);
+            *r = lval_err(
                 "Function passed too many arguments."
                 "Got %i, Expected %i.", given, total);
+            return NULL;
         }
 
-        lval *sym = lval_pop(v->formals, 0);
+        lval *sym = v->formals->cell[f++];
 
-        if (strcmp(sym->sym, "&") == 0) {
-            if (v->formals->count != 1) {
-                lval_delete(k);
-                return lval_err("Function format invalid. "
+        if (sym->sym == lsym_rest) {
+            if (v->formals->count - f != 1) {
+                lenv_delete(env);
+                *r = lval_err("Function format invalid. "
                 "Symbol '&' not followed by single symbol.");
+                return NULL;
             }
 
-            lval *nsym = lval_pop(v->formals, 0);
-            lenv_put(v->env, nsym, builtin_list(e, k));
-            lval_delete(sym);
-            lval_delete(nsym);
+            lval *rest = lval_qexpr();
+            for (; i < n; i++) {
+                lval_add(rest, args[i]);
+            }
+            lenv_put(env, v->formals->cell[f++], rest);
             break;
         }
 
-        lval *val = lval_pop(k, 0);
-
-        lenv_put(v->env, sym, val);
-        lval_delete(sym);
-        lval_delete(val);
+        lenv_put(env, sym, args[i]);
     }
 
-    lval_delete(k);
-
-    if (v->formals->count > 0 && 
-        strcmp(v->formals->cell[0]->sym, "&") == 0) {
-            if (v->formals->count != 2) {
-                return lval_err("Function format invalid"
+    if (f < v->formals->count && 
+        v->formals->cell[f]->sym == lsym_rest) {
+            if (v->formals->count - f != 2) {
+                lenv_delete(env);
+                *r = lval_err("Function format invalid"
                 "Symbol '&' not followed by a single symbol.");
+                return NULL;
             }
 
-            lval_delete(lval_pop(v->formals, 0));
+            lenv_put(env, v->formals->cell[f+1], lval_qexpr());
+            f += 2;
+    } 
 
-            lval *sym = lval_pop(v->formals, 0);
-            lval *val = lval_qexpr();
+    if (f == v->formals->count) { return env; }
 
-            lenv_put(v->env, sym, val);
-            lval_delete(sym);
-            lval_delete(val);
-    } 
+    // partially applied. the new function keeps the full formals' code,
+    // slots stay valid because the bound ones come first in env
+    lval *x = lval_fun(NULL);
+    x->env = env;
+    x->formals = lval_qexpr();
+    for (int i = f; i < v->formals->count; i++) {
+        lval_add(x->formals, v->formals->cell[i]);
+    }
+    x->body = v->body;
+    x->code = v->code;
+    x->code->refs++;
+    *r = x;
+    return NULL;
+}
 
-    if (v->formals->count == 0) {
-        v->env->par = e;
-        return builtin_eval(v->env, lval_add(lval_sexpr(), lval_copy(v->body)));
-    } else {
-        return lval_copy(v);
+// makes room for n more vals after v's and returns where they go, v->count
+// already covers them. the room is taken in place when v ends where the
+// used part of its buffer does, else v moves to a new buffer with as much
+// again spare, so growing a list one val at a time stays amortised O(1)
+lval **lval_grow(lval *v, int n) {
+    lcells *b = v->buf;
+    int start = b ? (int) (v->cell - b->cells) : 0;
+
+    // a list alone in its buffer can use all of it
+    if (b && b->refs == 1) { b->lo = start; b->hi = start + v->count; }
+
+    if (!b || start + v->count != b->hi || b->cap - b->hi < n) {
+        b = lcells_alloc(2 * (v->count + n));
+        if (v->count) { memcpy(b->cells, v->cell, sizeof(lval *) * v->count); }
+        b->hi = v->count;
+        lcells_release(v->buf);
+        v->buf = b;
+        v->cell = b->cells;
     }
+
+    lval **p = v->cell + v->count;
+    b->hi += n;
+    v->count += n;
+    return p;
 }
 
-lval *lval_add(lval *v, lval *x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval *) * v->count);
-    v->cell[v->count-1] = x;
+// same as lval_grow but the room is made before v's first val. a new
+// buffer keeps v at its end, lists are mostly built by consing onto them
+lval **lval_grow_front(lval *v, int n) {
+    lcells *b = v->buf;
+    int start = b ? (int) (v->cell - b->cells) : 0;
+
+    if (b && b->refs == 1) { b->lo = start; b->hi = start + v->count; }
+
+    if (!b || start != b->lo || b->lo < n) {
+        b = lcells_alloc(2 * (v->count + n));
+        b->hi = b->cap;
+        b->lo = b->cap - v->count;
+        if (v->count) { memcpy(b->cells + b->lo, v->cell, sizeof(lval *) * v->count); }
+        lcells_release(v->buf);
+        v->buf = b;
+        v->cell = b->cells + b->lo;
+    }
+
+    b->lo -= n;
+    v->cell -= n;
+    v->count += n;
+    return v->cell;
+}
 
+lval *lval_add(lval *v, lval *x) {
+    *lval_grow(v, 1) = x;
     return v;
 }
 
+// the first val is dropped by moving the start of v along, anything else is
+// shifted out. only ever used on fresh lists, the shift writes to the buffer
 lval *lval_pop(lval *v, int i) {
     lval *x = v->cell[i];
 
-    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval *) * (v->count-i-1));
+    if (i == 0) {
+        v->cell++;
+    } else {
+        memmove(&v->cell[i], &v->cell[i+1], sizeof(lval *) * (v->count-i-1));
+    }
     v->count--;
-    v->cell = realloc(v->cell, sizeof(lval *) * v->count);
 
     return x;
 }
 
-lval *lval_take(lval *v, int i) {
-    lval *x = lval_pop(v, i);
-    lval_delete(v);
+// a new list of the n vals of v from index i, sharing v's buffer
+lval *lval_slice(lval *v, int i, int n) {
+    lval *x = v->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+    if (n == 0) { return x; }
+
+    x->buf = v->buf;
+    x->buf->refs++;
+    x->cell = v->cell + i;
+    x->count = n;
     return x;
 }
 
-lval *builtin(lenv *e, lval *a, char *func) {
-    if (strcmp("list", func) == 0) { return builtin_list(e, a); }
-    if (strcmp("head", func) == 0) { return builtin_head(e, a); }
-    if (strcmp("tail", func) == 0) { return builtin_tail(e, a); }
-    if (strcmp("join", func) == 0) { return builtin_join(e, a); }
-    if (strcmp("eval", func) == 0) { return builtin_eval(e, a); }
-    if (strstr("+-/*^\%", func)) { return builtin_op(e, a, func); }
-    if (strstr("addsubmulremexp", func)) { return builtin_op(e, a, func); }
-
-    lval_delete(a);
-
-    return lval_err("Unknown operation '%s'", func);
+// picks one val out of a list that is about to be dropped
+lval *lval_take(lval *v, int i) {
+    return v->cell[i];
 }
 
-lval *builtin_op(lenv *e, lval *a, char *op) {
-    for (int i = 0; i < a->count; i++) {
-        if (a->cell[i]->type != LVAL_NUM) {
-            lval_delete(a);
-            return lval_err("Cannot operate on non-number '%s'", a->cell[i]->sym);
+// the operands are gathered into a flat array of longs first so the kernels
+// above can run over them without touching an lval. small calls use the stack
+#define LNUM_STACK 64
+
+lval *builtin_op(lenv *e, lval *a, int op) {
+    int n = a->count;
+    long buf[LNUM_STACK], *y = buf;
+    if (n > LNUM_STACK) { y = malloc(sizeof(long) * n); }
+
+    for (int i = 0; i < n; i++) {
+        lval *c = a->cell[i];
+        if (lval_type(c) != LVAL_NUM) {
+            if (y != buf) { free(y); }
+            // the cell need not be a symbol, name its type
+            return lval_err("Cannot operate on non-number. Got %s.",
+                ltype_name(lval_type(c)));
         }
+        y[i] = lval_to_num(c);
     }
 
-    lval *x = lval_pop(a, 0);
+    // the first operand is what the rest get folded into
+    long x = n ? lval_to_num(a->cell[0]) : 0;
+    int err = n ? lnum_op(op, y + 1, n - 1, &x) : -1;
+    if (y != buf) { free(y); }
 
-    if (strcmp(op, "-") == 0 && a->count == 0) {
-        x->num = -x->num;
+    switch (err) {
+        case LERR_DIV_ZERO: return lval_err("Cannot divide by Zero!");
+        case LERR_OVERFLOW: return lval_err("Integer overflow!");
+        case LERR_BAD_OP: return lval_err("Unknown operation!");
     }
 
-    while (a->count > 0) {
-        lval *y = lval_pop(a, 0);
-
-        if (strcmp(op, "+") == 0 || (strcmp(op, "add") == 0)) { x->num += y->num; }
-        if (strcmp(op, "-") == 0 || (strcmp(op, "sub") == 0)) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0 || (strcmp(op, "mul") == 0)) { x->num *= y->num; }
-        if (strcmp(op, "%") == 0 || (strcmp(op, "rem") == 0)) { x->num %= y->num; }
-        if (strcmp(op, "^") == 0 || (strcmp(op, "exp") == 0)) { 
-            if (y->num == 0) { x->num = 1; }
-            if (y->num == 1) { x->num; }
-            for (int i = 1; i < y->num ; i++) {
-                x->num *= x->num;
-            }
-            x->num; 
-        }
-        if (strcmp(op, "/") == 0 || (strcmp(op, "div") == 0)) { 
-            if (y->num == 0) {
-                lval_delete(x);
-                lval_delete(y);
-                x = lval_err("Cannot divide by Zero!");
-                break;
-            }
-            x->num /= y ->num;
-        }
-
-        lval_delete(y);
-        }
-
-    lval_delete(a);
-    return x;
+    // the result is boxed (if at all) once at the end
+    return lval_num(x);
 }
 
 //macros or preprocessors are like functions that generate some code
@@ -494,16 +1829,14 @@ lval *builtin_op(lenv *e, lval *a, char *op) {
 // todo: why are these necessary? seem like functions alts.
 #define LASSERT(args, cond, fmt, ...) \
     if (!(cond)) { \
-        lval *err = lval_err(fmt, ##__VA_ARGS__); \
-        lval_delete(args); \
-        return err; \
+        return lval_err(fmt, ##__VA_ARGS__); \
     }
 
 
 #define LASSERT_TYPE(syms, args, index, expect) \
-    LASSERT(args, args->cell[index]->type == expect, \
+    LASSERT(args, lval_type(args->cell[index]) == expect, \
     "Function '%s' passed incorrect type for argument %i." \
-    "Got %i, Expected %i.", syms, index, ltype_name(args->cell[index]->type), ltype_name(expect));
+    "Got %s, Expected %s.", syms, index, ltype_name(lval_type(args->cell[index])), ltype_name(expect));
 
 #define LASSERT_NUM(syms, args, num) \
     LASSERT(args, args->count == num, \
@@ -515,35 +1848,28 @@ lval *builtin_op(lenv *e, lval *a, char *op) {
     "Function '%s' passed {} for argument %i.", func, index);
 
 
-// todo: preprocessor that takes operation
 lval *builtin_add(lenv *e, lval *a) {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function '+' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
-    return builtin_op(e, a, "+");
+    return builtin_op(e, a, LOP_ADD);
 }
 
 lval *builtin_sub(lenv *e, lval *a) {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function '-' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
-    return builtin_op(e, a, "-");
+    return builtin_op(e, a, LOP_SUB);
 }
 
 lval *builtin_mul(lenv *e, lval *a) {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function '*' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
-    return builtin_op(e, a, "*");
+    return builtin_op(e, a, LOP_MUL);
 }
 
 lval *builtin_div(lenv *e, lval *a) {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function '/' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
-    return builtin_op(e, a, "/");
+    return builtin_op(e, a, LOP_DIV);
 }
 
 lval *builtin_exp(lenv *e, lval *a) {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function '^' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
-    return builtin_op(e, a, "^");
+    return builtin_op(e, a, LOP_EXP);
 }
 
 lval *builtin_mod(lenv *e, lval *a) {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function '\%' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
-    return builtin_op(e, a, "%");
+    return builtin_op(e, a, LOP_REM);
 }
 
 
@@ -553,21 +1879,19 @@ lval *builtin_head(lenv *e, lval* a) {
     LASSERT(a, a->cell[0]->count != 0, "Function 'head' passed empty braces {}!", "Got %i, Expected %i", a->cell[0]->count, 0);
     
 
-    lval *v = lval_take(a, 0);
-    while (v->count > 1) {
-        lval_delete(lval_pop(v, 1));
-    }
+    // values are never changed in place, build a new list
+    lval *v = lval_qexpr();
+    lval_add(v, a->cell[0]->cell[0]);
     return v;
 }
 
 lval *builtin_tail(lenv *e, lval* a) {
     LASSERT(a, a->count == 1, "Function 'tail' passed too many arguments!", "Got %i, Expected %i", a->count, 1);
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'tail' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR, "Function 'tail' passed incorrect type.", "Got %s, Expected %s", ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
     LASSERT(a, a->cell[0]->count != 0, "Function 'tail' passed empty braces {}!", "Got %i, Expected %i", a->cell[0]->count, 0);
 
-    lval *v = lval_take(a, 0);
-    lval_delete(lval_pop(v, 0));
-    return v;
+    lval *q = a->cell[0];
+    return lval_slice(q, 1, q->count - 1);
 }
 
 lval *builtin_list(lenv *e, lval *a) {
@@ -577,29 +1901,25 @@ lval *builtin_list(lenv *e, lval *a) {
 
 lval *builtin_eval(lenv *e, lval *a) {
     LASSERT(a, a->count == 1, "Function 'eval' passed too many arguments!", "Got %i, Expected %i", a->count, 1);
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'eval' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR, "Function 'eval' passed incorrect type.", "Got %s, Expected %s", ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
-    // todo: why are we calling lval_take here?
-    // take calls pops for the last element in a->cell
-    // pop copies vals from cell[0] to cell[0+1] and resizes a->cell to a->cell-1
-    // a->cell = [{1 2 3}] wont this be empty if we pop?
-    lval *x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    // the Q-expression is compiled as it is, no need to retag it as an
+    // S-expression (and so copy it, it may be shared)
+    return lval_eval_sexpr(e, lval_take(a, 0));
 }
 
 lval *builtin_join(lenv *e, lval *a) {
     for (int i = 0; i < a->count; i++) {
-        LASSERT(a, a->cell[i]->type == LVAL_QEXPR, "Function 'join' passed incorrect type.", "Got %s, Expected %s", ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+        LASSERT(a, lval_type(a->cell[i]) == LVAL_QEXPR, "Function 'join' passed incorrect type.", "Got %s, Expected %s", ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
     }
 
-    lval *x = lval_pop(a, 0);
+    if (a->count == 0) { return lval_qexpr(); }
 
-    while (a->count) {
-        x = lval_join(x, lval_pop(a, 0));
+    lval *x = a->cell[0];
+    for (int i = 1; i < a->count; i++) {
+        x = lval_join(x, a->cell[i]);
     }
 
-    lval_delete(a);
     return x;
 }
 
@@ -608,10 +1928,10 @@ lval *builtin_var(lenv *e, lval *v, char *func) {
 
     lval *syms = v->cell[0];
     for (int i = 0; i < syms->count; i++) {
-        LASSERT(v, (syms->cell[i]->type == LVAL_SYM), \
+        LASSERT(v, (lval_type(syms->cell[i]) == LVAL_SYM), \
         "Function '%s' cannot define non-symbol. " \
         "Got %s, Expected %s.", func, 
-        ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+        ltype_name(lval_type(syms->cell[i])), ltype_name(LVAL_SYM));
     }
 
     LASSERT(v, (syms->count == v->count-1), \
@@ -628,7 +1948,6 @@ lval *builtin_var(lenv *e, lval *v, char *func) {
         }
     }
 
-    lval_delete(v);
     return lval_sexpr();
 }
 
@@ -638,14 +1957,13 @@ lval *builtin_lambda(lenv *e, lval *v) {
     LASSERT_TYPE("\\", v, 1, LVAL_QEXPR);
 
     for (int i = 0; i < v->cell[0]->count; i++) {
-        LASSERT(v, (v->cell[0]->cell[i]->type == LVAL_SYM),
+        LASSERT(v, (lval_type(v->cell[0]->cell[i]) == LVAL_SYM),
         "Cannot define non-symbol. Got %s expected %s.",
-        ltype_name(v->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+        ltype_name(lval_type(v->cell[0]->cell[i])), ltype_name(LVAL_SYM));
     }
 
     lval *formals = lval_pop(v, 0);
     lval *body = lval_pop(v, 0);
-    lval_delete(v);
 
     return lval_constructor(formals, body);
 }
@@ -659,63 +1977,146 @@ lval *builtin_put(lenv *e, lval *a) {
     return builtin_var(e, a, "=");
 }
 
+// trace {ast eval quiet} turns on just the ones listed, trace {} turns
+// them all off
+lval *builtin_trace(lenv *e, lval *a) {
+    LASSERT_NUM("trace", a, 1);
+    LASSERT_TYPE("trace", a, 0, LVAL_QEXPR);
+
+    lval *q = a->cell[0];
+    int flags = 0;
+    for (int i = 0; i < q->count; i++) {
+        LASSERT(a, lval_type(q->cell[i]) == LVAL_SYM,
+            "Function 'trace' passed non-symbol. Got %s, Expected %s.",
+            ltype_name(lval_type(q->cell[i])), ltype_name(LVAL_SYM));
+
+        char *s = q->cell[i]->sym;
+        if (strcmp(s, "ast") == 0) {
+            flags |= LTRACE_AST;
+        } else if (strcmp(s, "eval") == 0) {
+            flags |= LTRACE_EVAL;
+        } else if (strcmp(s, "quiet") == 0) {
+            flags |= LTRACE_QUIET;
+        } else {
+            return lval_err("Function 'trace' passed unknown trace '%s'.", s);
+        }
+    }
 
+    ltrace = flags;
+    return lval_sexpr();
+}
+
+
+// a list of x's vals followed by y's. x and y are left as they are, the
+// longer of the two has its buffer shared and grown in place where it can
+// be, so appending to or consing onto a long list only costs the short one
 lval *lval_join(lval *x, lval *y) {
-    // squeeze out vals from y->cell and add to x
-    for (int i = 0; i < y->count; i++) {
-        x = lval_add(x, lval_pop(y, 0));
+    if (y->count == 0) { return x; }
+    if (x->count == 0) { return y; }
+
+    if (x->count >= y->count) {
+        lval *v = lval_slice(x, 0, x->count);
+        memcpy(lval_grow(v, y->count), y->cell, sizeof(lval *) * y->count);
+        return v;
     }
-    free(y->cell);
-    free(y);
-    // while (y->count) {
-    // }
 
-    // lval_delete(y);
-    return x;
+    lval *v = lval_slice(y, 0, y->count);
+    memcpy(lval_grow_front(v, x->count), x->cell, sizeof(lval *) * x->count);
+    return v;
 }
 
 lval *lval_fun(lbuiltin func) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUNC;
+    lval *v = lval_alloc(LVAL_FUNC);
     v->func = func;
+    v->code = NULL;
     return v;
 }
 
-lval *lenv_get(lenv *e, lval *k) {
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
+// syms are interned so the pointer itself is the key
+static unsigned long lenv_hash(char *sym) {
+    unsigned long h = (unsigned long) sym;
+    return (h >> 4) ^ (h >> 16);
+}
+
+int lenv_find(lenv *e, char *sym) {
+    if (e->index) {
+        int mask = e->index_cap - 1;
+        int h = lenv_hash(sym) & mask;
+        while (e->index[h]) {
+            int i = e->index[h] - 1;
+            if (e->syms[i] == sym) { return i; }
+            h = (h + 1) & mask;
         }
+        return -1;
     }
 
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("unbound symbol: '%s'", k->sym);
+    for (int i = 0; i < e->count; i++) {
+        if (e->syms[i] == sym) { return i; }
+    }
+    return -1;
+}
+
+static void lenv_index_add(lenv *e, int i) {
+    int mask = e->index_cap - 1;
+    int h = lenv_hash(e->syms[i]) & mask;
+    while (e->index[h]) {
+        h = (h + 1) & mask;
+    }
+    e->index[h] = i + 1;
+}
+
+// rebuilds the index at no more than half full
+static void lenv_reindex(lenv *e) {
+    int cap = 16;
+    while (cap < e->count * 2) { cap *= 2; }
+
+    free(e->index);
+    e->index = calloc(cap, sizeof(int));
+    e->index_cap = cap;
+    for (int i = 0; i < e->count; i++) {
+        lenv_index_add(e, i);
+    }
+}
+
+lval *lenv_get(lenv *e, lval *k) {
+    for (; e; e = e->par) {
+        int i = lenv_find(e, k->sym);
+        if (i >= 0) { return e->vals[i]; }
     }
+
+    return lval_err("unbound symbol: '%s'", k->sym);
 }
 
 lenv *lenv_new(void) {
-    lenv *e = malloc(sizeof(lenv));
+    lenv *e = lslab_alloc(&lenv_slab);
     e->par = NULL;
     e->count = 0;
+    e->cap = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->index = NULL;
+    e->index_cap = 0;
+    e->mark = 0;
     return e;
 }
 
 lenv *lenv_copy(lenv *e) {
-    lenv *n = malloc(sizeof(lenv));
+    lenv *n = lslab_alloc(&lenv_slab);
     n->par = e->par;
     n->count = e->count;
-    n->syms = malloc(sizeof(char *) * n->count);
-    n->vals = malloc(sizeof(lval *) * n->count);
+    n->cap = e->count;
+    n->syms = malloc(sizeof(char *) * n->cap);
+    n->vals = malloc(sizeof(lval *) * n->cap);
 
     for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+        n->syms[i] = e->syms[i];
+        n->vals[i] = e->vals[i];
     }
+
+    n->index = NULL;
+    n->index_cap = 0;
+    n->mark = 0;
+    if (e->index) { lenv_reindex(n); }
     return n;
 }
 
@@ -723,8 +2124,6 @@ void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
     lval *k = lval_sym(name);
     lval *v = lval_fun(func);
     lenv_put(e, k, v);
-    lval_delete(k);
-    lval_delete(v);
 }
 
 void lenv_add_builtins(lenv *e) {
@@ -742,6 +2141,12 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "/", builtin_div);
     lenv_add_builtin(e, "^", builtin_exp);
     lenv_add_builtin(e, "%", builtin_mod);
+    lenv_add_builtin(e, "add", builtin_add);
+    lenv_add_builtin(e, "sub", builtin_sub);
+    lenv_add_builtin(e, "mul", builtin_mul);
+    lenv_add_builtin(e, "div", builtin_div);
+    lenv_add_builtin(e, "exp", builtin_exp);
+    lenv_add_builtin(e, "rem", builtin_mod);
 
     // variable functions
     lenv_add_builtin(e, "def", builtin_def);
@@ -749,23 +2154,33 @@ void lenv_add_builtins(lenv *e) {
 
     // userdefined functions
     lenv_add_builtin(e, "\\", builtin_lambda);
+
+    // debugging
+    lenv_add_builtin(e, "trace", builtin_trace);
 }   
 
 void lenv_put(lenv *e, lval *k, lval *v) {
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_delete(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-        }
+    int i = lenv_find(e, k->sym);
+    if (i >= 0) {
+        e->vals[i] = v;
+        return;
     }
 
+    if (e->count == e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 4;
+        e->vals = realloc(e->vals, sizeof(lval *) * e->cap);
+        e->syms = realloc(e->syms, sizeof(char *) * e->cap);
+    }
     e->count++;
-    e->vals = realloc(e->vals, sizeof(lval *) * e->count);
-    e->syms = realloc(e->syms, sizeof(char *) * e->count);
 
-    e->vals[e->count - 1] = lval_copy(v);
-    e->syms[e->count - 1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count -1], k->sym);
+    e->vals[e->count - 1] = v;
+    e->syms[e->count - 1] = k->sym;
+
+    if (e->index && e->count * 2 <= e->index_cap) {
+        lenv_index_add(e, e->count - 1);
+    } else if (e->index || e->count > LENV_INDEX_MIN) {
+        lenv_reindex(e);
+    }
 }
 
 void lenv_def(lenv *e, lval *k, lval *v) {
@@ -776,43 +2191,12 @@ void lenv_def(lenv *e, lval *k, lval *v) {
     lenv_put(e, k, v);
 }
 
+// frees the env itself, its vals are left to the collector
 void lenv_delete(lenv *e) {
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        lval_delete(e->vals[i]);
-    }
     free(e->syms);
     free(e->vals);
-    free(e); // todo: why not just free(e) instead of everything else?
-}
-
-void lval_delete(lval *v) {
-    switch (v->type) {
-        case LVAL_NUM: 
-            break;
-        case LVAL_SYM: 
-            free(v->sym); 
-            break;
-        case LVAL_FUNC:
-            if (!v->func) {
-                lenv_delete(v->env);
-                lval_delete(v->formals);
-                lval_delete(v->body);
-            }
-            break;
-        case LVAL_ERR: 
-            free(v->err); 
-            break;
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            for (int i = 0; i < v->count; i++) {
-                lval_delete(v->cell[i]);    
-            }
-            free(v->cell);
-        break;
-    }
-
-    free(v);
+    free(e->index);
+    lslab_free(&lenv_slab, e); // todo: why not just free(e) instead of everything else?
 }
 
 void lval_expr_print(lval *v, char open, char close) {
@@ -831,9 +2215,9 @@ void lval_expr_print(lval *v, char open, char close) {
 // like 0, 1, 2, 3, ..., 9, enum_val, how does this work? 
 // how does the err case work?
 void lval_print(lval *v) {
-    switch (v->type) {
+    switch (lval_type(v)) {
         case LVAL_NUM:
-            printf("%li", v->num);
+            printf("%li", lval_to_num(v));
             break;
 
         case LVAL_ERR:
@@ -864,48 +2248,8 @@ void lval_println(lval *v) {
     putchar('\n');
 }
 
-lval *lval_copy(lval *v) {
-
-    lval *x = malloc(sizeof(lval));
-    x->type = v->type;
-
-    switch (v->type) {
-        case LVAL_FUNC:
-            if (v->func) {
-                x->func = v->func; 
-            } else {
-                x->func = NULL;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
-            }
-            break;
-        case LVAL_NUM: 
-            x->num = v->num;
-            break;
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err);
-            break;
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->err) + 1);
-            strcpy(x->sym, v->sym);
-            break;
-        case LVAL_SEXPR:
-        case LVAL_QEXPR:
-            x->count = v->count;
-            x->cell = malloc(sizeof(lval *) * x->count);
-            for (int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]); 
-            }
-        break;
-    }
-    return x;
-}
-
 lval *lval_constructor(lval *formals, lval *body) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUNC;
+    lval *v = lval_alloc(LVAL_FUNC);
 
     // we want user defined functions to be set to NULL so we can
     // tell them apart from inbuilt ones
@@ -914,6 +2258,7 @@ lval *lval_constructor(lval *formals, lval *body) {
 
     v->formals = formals;
     v->body = body;
+    v->code = lcode_compile(body, formals);
 
     return v;
 }